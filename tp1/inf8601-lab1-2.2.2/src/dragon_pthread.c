@@ -22,6 +22,15 @@
 
 pthread_mutex_t mutex_stdout;
 
+static const struct topology *placement_topo = NULL;
+static int placement_policy = TOPO_NONE;
+
+void dragon_pthread_placement(const struct topology *topo, int policy)
+{
+	placement_topo = topo;
+	placement_policy = policy;
+}
+
 void printf_threadsafe(char *format, ...)
 {
 	va_list ap;
@@ -41,6 +50,8 @@ void* dragon_draw_worker(void *data)
 {
 	struct draw_data* worker_data = (struct draw_data*) data;
 
+	topology_pin(placement_topo, placement_policy, worker_data->id);
+
 	/* 1. Initialiser la surface */
 	int stepZone = worker_data->dragon_height * worker_data->dragon_width / worker_data->nb_thread;
 	int startZone = worker_data->id * stepZone;
@@ -209,6 +220,8 @@ void *dragon_limit_worker(void *data)
 	int start = lim->start;
 	int end = lim->end;
 
+	topology_pin(placement_topo, placement_policy, lim->id);
+
 	for (i = 0; i < NB_TILES; i++) {
 		piece_limit(start, end, &lim->pieces[i]);
 	}
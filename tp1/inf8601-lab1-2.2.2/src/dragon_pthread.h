@@ -9,7 +9,10 @@
 #define DRAGON_PTHREAD_H_
 
 #include "dragon.h"
+#include "topology.h"
 
+/* Pin worker id with policy (see topology.h) in the following draws and limits. */
+void dragon_pthread_placement(const struct topology *topo, int policy);
 int dragon_draw_pthread(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread);
 int dragon_limits_pthread(limits_t *lim, uint64_t size, int nb_thread);
 
@@ -24,6 +24,7 @@
 #include "dragon.h"
 #include "dragon_pthread.h"
 #include "dragon_tbb.h"
+#include "topology.h"
 
 /* Globals and defaults */
 #define PROGNAME "dragonizer"
@@ -62,6 +63,8 @@ struct command_opts {
 	int power_max;
 	int verbose;
 	uint64_t size;
+	int placement;
+	struct topology *topo;
 };
 
 typedef int (*draw_handler)(char **, struct rgb *, int, int, uint64_t, int);
@@ -117,6 +120,8 @@ static void usage(void)
 	fprintf(stderr, "  --size	set dragon size\n");
 	fprintf(stderr, "  --power  set dragon size by power\n");
 	fprintf(stderr, "  --max    compute all dragon to max power\n");
+	fprintf(stderr, "  --placement pin the pthread workers "\
+			"[ none | compact | scatter | core | socket ]\n");
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
@@ -393,6 +398,7 @@ static void dump_opts(struct command_opts *opts)
 	printf("%10s %" PRId64 "\n", "size", opts->size);
 	printf("%10s %d\n", "power", opts->power);
 	printf("%10s %d\n", "max", opts->power_max);
+	printf("%10s %s\n", "placement", topology_name(opts->placement));
 }
 
 void default_int_value(int *value, int def)
@@ -419,12 +425,13 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 			{ "power",	 1, 0, 'p' },
 			{ "max",	 1, 0, 'm' },
 			{ "verbose", 0, 0, 'v' },
+			{ "placement", 1, 0, 'P' },
 			{ 0, 0, 0, 0}
 	};
 
 	memset(opts, 0, sizeof(struct command_opts));
 
-	while ((opt = getopt_long(argc, argv, "hvx:y:s:c:t:l:p:o:m:", options, &idx)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hvx:y:s:c:t:l:p:o:m:P:", options, &idx)) != -1) {
 		switch(opt) {
 		case 'c':
 			opts->cmd = lookup_cmd(optarg);
@@ -464,6 +471,14 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 		case 'v':
 			opts->verbose = 1;
 			break;
+		case 'P':
+			opts->placement = topology_lookup(optarg);
+			if (opts->placement < 0) {
+				printf("unknown placement %s\n", optarg);
+				opts->placement = TOPO_NONE;
+				ret = -1;
+			}
+			break;
 		default:
 			printf("unknown option %c\n", opt);
 			ret = -1;
@@ -514,6 +529,13 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 		ret = -1;
 	}
 
+	if (opts->placement != TOPO_NONE) {
+		opts->topo = topology_load();
+		if (opts->topo == NULL)
+			fprintf(stderr, "cannot read the cpu topology, threads not pinned\n");
+		dragon_pthread_placement(opts->topo, opts->placement);
+	}
+
 	if (opts->verbose)
 		dump_opts(opts);
 
@@ -542,6 +564,7 @@ int main(int argc, char **argv)
 		goto err;
 	}
 
+	topology_free(opts.topo);
 	return EXIT_SUCCESS;
 
 	err:
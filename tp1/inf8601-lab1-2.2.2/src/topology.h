@@ -0,0 +1 @@
+../../../tp2/inf8601-lab2/src/topology.h
\ No newline at end of file
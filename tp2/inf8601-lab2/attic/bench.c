@@ -0,0 +1,463 @@
+/*
+ * bench.c
+ *
+ * Headless benchmark of the fluid solver: scripted density sources and
+ * forces instead of the mouse of demo.c, a fixed number of steps, the
+ * time per step broken down by phase and density snapshots as PPM.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <omp.h>
+
+#include "color.h"
+#include "solver.h"
+
+#define IX(i,j) ((i)+(N+2)*(j))
+
+#define PROGNAME "bench"
+
+#define DEFAULT_SIZE 256
+#define DEFAULT_STEPS 100
+#define DEFAULT_WARMUP 5
+#define DEFAULT_SCENARIO_NAME "plume"
+#define DEFAULT_SOLVER_NAME "mg"
+#define DEFAULT_TOL 1e-3f
+#define DEFAULT_DT 0.1f
+#define DEFAULT_FORCE 5.0f
+#define DEFAULT_SOURCE 100.0f
+#define MAX_SCALARS 5
+
+/*
+ * A disk that adds density and pushes the fluid while the step is in
+ * [start, stop), stop 0 for the whole run. Positions and radius are
+ * fractions of the grid so that a scenario plays the same at any N, the
+ * density and the force are scaled by --source and --force like the
+ * mouse of demo.c.
+ */
+struct emitter {
+	float x, y;
+	float radius;
+	float dens;
+	float u, v;
+	int start, stop;
+};
+
+struct scenario {
+	const char *name;
+	const struct emitter *emitters;
+	int count;
+};
+
+static const struct emitter plume[] = {
+	{ 0.50f, 0.10f, 0.04f, 0.01f,  0.0f, 1.0f,   0, 0 },
+};
+
+/* two jets meet in the middle, a burst from the top comes later */
+static const struct emitter jets[] = {
+	{ 0.10f, 0.45f, 0.03f, 0.01f,  1.0f, 0.1f,   0, 0 },
+	{ 0.90f, 0.55f, 0.03f, 0.01f, -1.0f, -0.1f,  0, 0 },
+	{ 0.50f, 0.90f, 0.05f, 0.005f, 0.0f, -2.0f, 50, 80 },
+};
+
+/* a plume blown left and right by gusts */
+static const struct emitter gusts[] = {
+	{ 0.50f, 0.10f, 0.04f, 0.01f,  0.0f, 1.0f,   0, 0 },
+	{ 0.05f, 0.50f, 0.08f, 0.0f,   2.0f, 0.0f,  20, 40 },
+	{ 0.95f, 0.50f, 0.08f, 0.0f,  -2.0f, 0.0f,  60, 80 },
+};
+
+#define SCENARIO(s) { #s, s, sizeof(s) / sizeof(s[0]) }
+
+static const struct scenario scenarios[] = {
+	SCENARIO(plume),
+	SCENARIO(jets),
+	SCENARIO(gusts),
+	{ NULL, NULL, 0 },
+};
+
+struct bench_opts {
+	int N;
+	int steps;
+	int warmup;
+	const struct scenario *scenario;
+	int solver;
+	float tol;
+	int max_iter;
+	float dt, diff, visc;
+	float force, source;
+	char *output;			/* snapshot prefix, NULL for none */
+	int every;
+	int fused;				/* fluid_step() instead of vel_step() and dens_step() */
+	int scalars;			/* passive scalars advected with the density */
+	int verbose;
+};
+
+static int N;
+static float *u, *v, *u_prev, *v_prev;
+static float *dens, *dens_prev;
+static float *scalar[MAX_SCALARS], *scalar_prev[MAX_SCALARS];
+
+__attribute__((noreturn))
+static void usage(void)
+{
+	int i;
+
+	fprintf(stderr, "Usage: " PROGNAME " [OPTIONS]\n");
+	fprintf(stderr, "\nOptions:\n");
+	fprintf(stderr, "  --help	this help\n");
+	fprintf(stderr, "  --size	grid resolution N (default %d)\n", DEFAULT_SIZE);
+	fprintf(stderr, "  --steps	timed steps (default %d)\n", DEFAULT_STEPS);
+	fprintf(stderr, "  --warmup	steps before timing (default %d)\n", DEFAULT_WARMUP);
+	fprintf(stderr, "  --scenario	sources and forces [");
+	for (i = 0; scenarios[i].name; i++)
+		fprintf(stderr, " %s%s", scenarios[i].name, scenarios[i + 1].name ? " |" : "");
+	fprintf(stderr, " ] (default %s)\n", DEFAULT_SCENARIO_NAME);
+	fprintf(stderr, "  --solver	pressure solver [ gs | cg | mg ] (default %s)\n",
+			DEFAULT_SOLVER_NAME);
+	fprintf(stderr, "  --tol		pressure residual relative to the divergence "
+			"(default %g)\n", DEFAULT_TOL);
+	fprintf(stderr, "  --max-iter	pressure solver iterations (0: solver default)\n");
+	fprintf(stderr, "  --dt		time step (default %g)\n", DEFAULT_DT);
+	fprintf(stderr, "  --diff	diffusion rate of the density (default 0)\n");
+	fprintf(stderr, "  --visc	viscosity of the fluid (default 0)\n");
+	fprintf(stderr, "  --force	scales the forces (default %g)\n", DEFAULT_FORCE);
+	fprintf(stderr, "  --source	scales the densities (default %g)\n", DEFAULT_SOURCE);
+	fprintf(stderr, "  --output	density snapshot prefix, <prefix>-<step>.ppm\n");
+	fprintf(stderr, "  --every	steps between snapshots (default: last step only)\n");
+	fprintf(stderr, "  --fused	advect velocity, density and scalars in one pass\n");
+	fprintf(stderr, "  --scalars	passive scalars carried with the density (0 to %d)\n",
+			MAX_SCALARS);
+	fprintf(stderr, "  --verbose	time of every step\n");
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+static const struct scenario *lookup_scenario(const char *name)
+{
+	int i;
+
+	for (i = 0; scenarios[i].name; i++)
+		if (strcmp(scenarios[i].name, name) == 0)
+			return &scenarios[i];
+	return NULL;
+}
+
+static void parse_opts(int argc, char **argv, struct bench_opts *opts)
+{
+	int idx;
+	int opt;
+
+	struct option options[] = {
+			{ "help",	 0, 0, 'h' },
+			{ "size",	 1, 0, 'n' },
+			{ "steps",	 1, 0, 'k' },
+			{ "warmup",	 1, 0, 'w' },
+			{ "scenario", 1, 0, 'S' },
+			{ "solver",	 1, 0, 's' },
+			{ "tol",	 1, 0, 't' },
+			{ "max-iter", 1, 0, 'm' },
+			{ "dt",		 1, 0, 'T' },
+			{ "diff",	 1, 0, 'D' },
+			{ "visc",	 1, 0, 'V' },
+			{ "force",	 1, 0, 'f' },
+			{ "source",	 1, 0, 'r' },
+			{ "output",	 1, 0, 'o' },
+			{ "every",	 1, 0, 'e' },
+			{ "fused",	 0, 0, 'F' },
+			{ "scalars", 1, 0, 'a' },
+			{ "verbose", 0, 0, 'v' },
+			{ 0, 0, 0, 0}
+	};
+
+	memset(opts, 0, sizeof(struct bench_opts));
+	opts->N = DEFAULT_SIZE;
+	opts->steps = DEFAULT_STEPS;
+	opts->warmup = DEFAULT_WARMUP;
+	opts->scenario = lookup_scenario(DEFAULT_SCENARIO_NAME);
+	opts->solver = pressure_lookup(DEFAULT_SOLVER_NAME);
+	opts->tol = DEFAULT_TOL;
+	opts->dt = DEFAULT_DT;
+	opts->force = DEFAULT_FORCE;
+	opts->source = DEFAULT_SOURCE;
+
+	while ((opt = getopt_long(argc, argv, "hvFn:k:w:S:s:t:m:T:D:V:f:r:o:e:a:", options, &idx)) != -1) {
+		switch(opt) {
+		case 'n':
+			opts->N = atoi(optarg);
+			break;
+		case 'k':
+			opts->steps = atoi(optarg);
+			break;
+		case 'w':
+			opts->warmup = atoi(optarg);
+			break;
+		case 'S':
+			opts->scenario = lookup_scenario(optarg);
+			break;
+		case 's':
+			opts->solver = pressure_lookup(optarg);
+			break;
+		case 't':
+			opts->tol = atof(optarg);
+			break;
+		case 'm':
+			opts->max_iter = atoi(optarg);
+			break;
+		case 'T':
+			opts->dt = atof(optarg);
+			break;
+		case 'D':
+			opts->diff = atof(optarg);
+			break;
+		case 'V':
+			opts->visc = atof(optarg);
+			break;
+		case 'f':
+			opts->force = atof(optarg);
+			break;
+		case 'r':
+			opts->source = atof(optarg);
+			break;
+		case 'o':
+			opts->output = optarg;
+			break;
+		case 'e':
+			opts->every = atoi(optarg);
+			break;
+		case 'F':
+			opts->fused = 1;
+			break;
+		case 'a':
+			opts->scalars = atoi(optarg);
+			break;
+		case 'v':
+			opts->verbose = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (optind < argc || opts->N < 8 || opts->steps < 1 || opts->warmup < 0 ||
+			opts->every < 0 || opts->scenario == NULL ||
+			opts->scalars < 0 || opts->scalars > MAX_SCALARS ||
+			pressure_config(opts->solver, opts->tol, opts->max_iter) < 0)
+		usage();
+}
+
+static void free_data(void)
+{
+	int k;
+
+	for (k = 0; k < MAX_SCALARS; k++) {
+		free(scalar[k]);
+		free(scalar_prev[k]);
+	}
+	free(u);
+	free(v);
+	free(u_prev);
+	free(v_prev);
+	free(dens);
+	free(dens_prev);
+}
+
+static int allocate_data(int scalars)
+{
+	size_t size = (size_t) (N + 2) * (N + 2) * sizeof(float);
+	int k;
+
+	u = calloc(1, size);
+	v = calloc(1, size);
+	u_prev = calloc(1, size);
+	v_prev = calloc(1, size);
+	dens = calloc(1, size);
+	dens_prev = calloc(1, size);
+	if (!u || !v || !u_prev || !v_prev || !dens || !dens_prev)
+		goto err;
+	for (k = 0; k < scalars; k++) {
+		scalar[k] = calloc(1, size);
+		scalar_prev[k] = calloc(1, size);
+		if (!scalar[k] || !scalar_prev[k])
+			goto err;
+	}
+	return 0;
+
+err:
+	fprintf(stderr, "cannot allocate data\n");
+	free_data();
+	return -1;
+}
+
+/*
+ * Sources of step k. The solver uses the previous fields as scratch, so
+ * like get_from_UI() in demo.c they are cleared first. The scalars are
+ * tracers with the sources of the density.
+ */
+static void inject(const struct bench_opts *opts, int k)
+{
+	const struct scenario *sc = opts->scenario;
+	size_t size = (size_t) (N + 2) * (N + 2) * sizeof(float);
+	int e, i, j, i0, i1, j0, j1, s;
+
+	memset(u_prev, 0, size);
+	memset(v_prev, 0, size);
+	memset(dens_prev, 0, size);
+	for (s = 0; s < opts->scalars; s++)
+		memset(scalar_prev[s], 0, size);
+
+	for (e = 0; e < sc->count; e++) {
+		const struct emitter *em = &sc->emitters[e];
+		float cx = em->x * N, cy = em->y * N, r = em->radius * N;
+
+		if (k < em->start || (em->stop && k >= em->stop))
+			continue;
+		if (r < 1)
+			r = 1;
+		i0 = cx - r < 1 ? 1 : cx - r;
+		i1 = cx + r > N ? N : cx + r;
+		j0 = cy - r < 1 ? 1 : cy - r;
+		j1 = cy + r > N ? N : cy + r;
+		for (j = j0; j <= j1; j++) {
+			for (i = i0; i <= i1; i++) {
+				if ((i - cx) * (i - cx) + (j - cy) * (j - cy) > r * r)
+					continue;
+				dens_prev[IX(i,j)] += opts->source * em->dens;
+				u_prev[IX(i,j)] += opts->force * em->u;
+				v_prev[IX(i,j)] += opts->force * em->v;
+				for (s = 0; s < opts->scalars; s++)
+					scalar_prev[s][IX(i,j)] += opts->source * em->dens;
+			}
+		}
+	}
+}
+
+/* grey levels as drawn by demo.c (density 1 is white), y up */
+static int save_density(const struct bench_opts *opts, int k)
+{
+	struct rgb *image;
+	char path[1024];
+	int i, j, ret;
+
+	image = malloc(sizeof(struct rgb) * N * N);
+	if (image == NULL)
+		return -1;
+	for (j = 1; j <= N; j++) {
+		for (i = 1; i <= N; i++) {
+			float d = dens[IX(i,j)];
+			struct rgb *pix = &image[(N - j) * N + (i - 1)];
+			pix->r = pix->g = pix->b = d >= 1 ? 255 : d <= 0 ? 0 : (unsigned char) (d * 255);
+		}
+	}
+	snprintf(path, sizeof(path), "%s-%05d.ppm", opts->output, k);
+	ret = save_image(path, image, N, N);
+	free(image);
+	return ret;
+}
+
+/*
+ * Total density and a position weighted sum: two runs with the same
+ * options, solver and thread count print the same values, a change to
+ * the solver shows up in the digits.
+ */
+static void checksum(double *mass, double *weighted)
+{
+	int i, j;
+
+	*mass = *weighted = 0;
+	for (j = 1; j <= N; j++) {
+		for (i = 1; i <= N; i++) {
+			*mass += dens[IX(i,j)];
+			*weighted += dens[IX(i,j)] * ((i * 31 + j * 17) % 97);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts;
+	struct pressure_stats st;
+	double times[NR_PHASES];
+	double t, total = 0, other, mass, weighted;
+	double fused, separate, single;
+	int k, p, s, fields;
+	int ret = EXIT_FAILURE;
+
+	parse_opts(argc, argv, &opts);
+	N = opts.N;
+	if (allocate_data(opts.scalars) < 0)
+		return EXIT_FAILURE;
+
+	printf("N %d steps %d warmup %d scenario %s solver %s tol %g step %s scalars %d threads %d\n",
+			N, opts.steps, opts.warmup, opts.scenario->name,
+			pressure_name(opts.solver), opts.tol, opts.fused ? "fused" : "separate",
+			opts.scalars, omp_get_max_threads());
+
+	for (k = 0; k < opts.warmup + opts.steps; k++) {
+		if (k == opts.warmup) {
+			phase_stats(times);
+			pressure_stats(&st);
+			if (opts.verbose)
+				printf("step,ms,divergence\n");
+		}
+		inject(&opts, k);
+		t = omp_get_wtime();
+		if (opts.fused) {
+			fluid_step(N, u, v, u_prev, v_prev, dens, dens_prev, opts.scalars,
+					scalar, scalar_prev, opts.visc, opts.diff, opts.dt);
+		} else {
+			vel_step(N, u, v, u_prev, v_prev, opts.visc, opts.dt);
+			dens_step(N, dens, dens_prev, u, v, opts.diff, opts.dt);
+			for (s = 0; s < opts.scalars; s++)
+				dens_step(N, scalar[s], scalar_prev[s], u, v, opts.diff, opts.dt);
+		}
+		t = omp_get_wtime() - t;
+		if (k >= opts.warmup) {
+			total += t;
+			if (opts.verbose)
+				printf("%d,%.3f,%.3g\n", k, t * 1e3, divergence(N, u, v));
+		}
+		if (opts.output && (k == opts.warmup + opts.steps - 1 ||
+				(opts.every && (k + 1) % opts.every == 0))) {
+			if (save_density(&opts, k) < 0)
+				goto done;
+		}
+	}
+
+	phase_stats(times);
+	pressure_stats(&st);
+	other = total;
+	printf("phase,ms_per_step,share\n");
+	for (p = 0; p < NR_PHASES; p++) {
+		printf("%s,%.3f,%.1f%%\n", phase_name(p), times[p] * 1e3 / opts.steps,
+				100 * times[p] / total);
+		other -= times[p];
+	}
+	printf("other,%.3f,%.1f%%\n", other * 1e3 / opts.steps, 100 * other / total);
+	printf("total,%.3f,100.0%%\n", total * 1e3 / opts.steps);
+	printf("pressure %.1f iterations per projection, worst residual %.3g\n",
+			st.calls ? (double) st.iterations / st.calls : 0.0, st.residual);
+
+	/* vel_step() advects u and v in one pass, dens_step() the density alone */
+	fields = 3 + opts.scalars;
+	fused = advect_bytes(N, fields, 1);
+	separate = advect_bytes(N, 2, 1) + advect_bytes(N, fields - 2, 0);
+	single = advect_bytes(N, fields, 0);
+	printf("advect %d fields, MiB per step: one pass %.1f, vel_step+dens_step %.1f, "
+			"one field at a time %.1f; saved %.1f (%.0f%%), %.2f GB/s\n",
+			fields, fused / (1 << 20), separate / (1 << 20), single / (1 << 20),
+			(single - (opts.fused ? fused : separate)) / (1 << 20),
+			100 * (single - (opts.fused ? fused : separate)) / single,
+			(opts.fused ? fused : separate) * opts.steps / times[PHASE_ADVECT] / 1e9);
+	checksum(&mass, &weighted);
+	printf("divergence %.6g mass %.9g checksum %.9g\n", divergence(N, u, v), mass, weighted);
+	ret = EXIT_SUCCESS;
+
+done:
+	free_data();
+	return ret;
+}
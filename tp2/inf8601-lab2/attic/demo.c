@@ -18,21 +18,19 @@
 #include <stdio.h>
 #include <GL/glut.h>
 
+#include "solver.h"
+
 /* macros */
 
 #define IX(i,j) ((i)+(N+2)*(j))
 
-/* external definitions (from solver.c) */
-
-extern void dens_step ( int N, float * x, float * x0, float * u, float * v, float diff, float dt );
-extern void vel_step ( int N, float * u, float * v, float * u0, float * v0, float visc, float dt );
-
 /* global variables */
 
 static int N;
 static float dt, diff, visc;
 static float force, source;
 static int dvel;
+static int solver = PRESSURE_MG;
 
 static float * u, * v, * u_prev, * v_prev;
 static float * dens, * dens_prev;
@@ -206,6 +204,16 @@ static void get_from_UI ( float * d, float * u, float * v )
   ----------------------------------------------------------------------
 */
 
+static void print_pressure_stats ( void )
+{
+	struct pressure_stats st;
+
+	pressure_stats ( &st );
+	if ( !st.calls ) return;
+	printf ( "%s: %.1f iterations per projection, residual %.3g, divergence %.3g\n",
+		pressure_name ( solver ), (float) st.iterations/st.calls, st.residual, divergence ( N, u, v ) );
+}
+
 static void key_func ( unsigned char key, int x, int y )
 {
 	switch ( key )
@@ -225,6 +233,17 @@ static void key_func ( unsigned char key, int x, int y )
 		case 'V':
 			dvel = !dvel;
 			break;
+
+		case 'p':
+		case 'P':
+			solver = (solver+1)%(PRESSURE_MG+1);
+			pressure_config ( solver, 1e-3f, 0 );
+			break;
+
+		case 's':
+		case 'S':
+			print_pressure_stats ();
+			break;
 	}
 }
 
@@ -348,6 +367,8 @@ int main ( int argc, char ** argv )
 	printf ( "\t Add velocities with the left mouse button and dragging the mouse\n" );
 	printf ( "\t Toggle density/velocity display with the 'v' key\n" );
 	printf ( "\t Clear the simulation by pressing the 'c' key\n" );
+	printf ( "\t Cycle the pressure solver (gs, cg, mg) with the 'p' key\n" );
+	printf ( "\t Print the pressure solver statistics with the 's' key\n" );
 	printf ( "\t Quit by pressing the 'q' key\n" );
 
 	dvel = 0;
@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <omp.h>
 #include "color.h"
 #include "solver.h"
 
@@ -92,9 +93,42 @@ void set(void)
 	}
 }
 
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage : %s [solver [N [steps [tol [max_iter]]]]]\n", prog);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t solver   : pressure solver, gs, cg or mg (default mg)\n");
+	fprintf(stderr, "\t N        : grid resolution, at least 400 for the sources (default 512)\n");
+	fprintf(stderr, "\t steps    : time steps (default 20)\n");
+	fprintf(stderr, "\t tol      : residual relative to the divergence (default 1e-3)\n");
+	fprintf(stderr, "\t max_iter : iteration limit of the solver, 0 for its default\n");
+	exit(1);
+}
+
 int main(int argc, char **argv)
 {
+	int solver = PRESSURE_MG;
+	int steps = 20;
+	float tol = 1e-3f;
+	int max_iter = 0;
+	struct pressure_stats st;
+	double t, total = 0;
+
 	N = 512;
+	if (argc > 6)
+		usage(argv[0]);
+	if (argc > 1 && (solver = pressure_lookup(argv[1])) < 0)
+		usage(argv[0]);
+	if (argc > 2 && (N = atoi(argv[2])) < 400)
+		usage(argv[0]);
+	if (argc > 3 && (steps = atoi(argv[3])) < 1)
+		usage(argv[0]);
+	if (argc > 4)
+		tol = atof(argv[4]);
+	if (argc > 5)
+		max_iter = atoi(argv[5]);
+	if (pressure_config(solver, tol, max_iter) < 0)
+		usage(argv[0]);
 	dt = 0.1f;
 	diff = 0.0f;
 	visc = 0.0f;
@@ -107,15 +141,24 @@ int main(int argc, char **argv)
 	char path[1024];
 	allocate_data();
 	clear_data();
-	for (k = 0; k < 20; k++) {
+	printf("solver %s N %d threads %d\n", pressure_name(solver), N, omp_get_max_threads());
+	printf("step,ms,iterations,residual,divergence\n");
+	for (k = 0; k < steps; k++) {
 		set();
+		t = omp_get_wtime();
 		vel_step ( N, u, v, u_prev, v_prev, visc, dt );
 		dens_step ( N, dens, dens_prev, u, v, diff, dt );
+		t = omp_get_wtime() - t;
+		total += t;
+		pressure_stats(&st);
+		printf("%d,%.3f,%.1f,%.3g,%.3g\n", k, t * 1e3,
+				(double) st.iterations / st.calls, st.residual, divergence(N, u, v));
 		dens_image(image, dens);
 		sprintf(path, "dens-%03d.ppm", k);
 		save_image(path, image, N+2, N+2);
 	}
 
+	printf("mean %.3f ms/step\n", total * 1e3 / steps);
 	free_data();
 	return 0;
 }
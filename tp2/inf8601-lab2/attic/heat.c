@@ -8,125 +8,188 @@
 #include <errno.h>
 #include <png.h>
 #include <math.h>
+#include <string.h>
+#include <sched.h>
+#include <getopt.h>
+#include <omp.h>
 
 #include "layer.h"
 #include "color.h"
-#include "util.h"
+#include "memory.h"
 #include "heat.h"
 #include "heat_cuda.h"
 
-void diffusion_1(stripe_array_t *sa_curr, stripe_array_t *sa_next, stripe_array_t *sa_diff)
+#define SPIN_YIELD 1000
+#define CACHE_LINE 64
+
+/*
+ * Progress of one stripe, read by its two neighbours. Each counter has
+ * its own cache line so that polling one does not steal the other, the
+ * array starts on a line (calloc_lines).
+ */
+struct stripe_sync {
+	int done;		/* sweeps finished */
+	char pad_done[CACHE_LINE - sizeof(int)];
+	int pulled;		/* sweeps for which the halo was copied */
+	char pad_pulled[CACHE_LINE - sizeof(int)];
+};
+
+/* zeroed array of n elements starting on a cache line */
+static void *calloc_lines(size_t n, size_t size)
 {
-	int k, r, i, j;
-	int width, height;
-	float *curr, *next, *diff;
-	if (sa_curr == NULL || sa_next == NULL || sa_diff == NULL)
-		return;
-	int len = sa_curr->len;
-	for(r=0; r < (20 + len); r++) {
-		#pragma omp parallel private(curr,next,diff,width,height,i,j,k)
-		{
-			#pragma omp for schedule(static,1)
-			for(k=0; k < len; k++) {
-				curr = sa_curr->stripes[k]->data;
-				next = sa_next->stripes[k]->data;
-				diff = sa_diff->stripes[k]->data;
-				width = sa_curr->stripes[k]->width;
-				height = sa_curr->stripes[k]->height;
-				for(j=1; j < height - 1; j++) {
-					for (i = 1; i < width - 1; i++) {
-						int c =	IX(i, j, width);
-						int n = IX(i, j-1, width);
-						int s = IX(i, j+1, width);
-						int w = IX(i-1, j, width);
-						int e = IX(i+1, j, width);
-						// epic fail
-						//float sum_diff = diff[n] + diff[s] + diff[e] + diff[w];
-						//next[c] = (curr[c] + diff[n] * next[n] + diff[s] * next[s] + diff[e] * next[e] + diff[w] * next[w]) / (1 + 4 * sum_diff);
-
-						// ok, mais facteur de diffusion cst
-						//next[c] = (curr[c] + diff[c]*(next[n] + next[s] + next[e] + next[w])) / (1 + 4 * diff[c]);
-
-						// methode instable avec diffusion cst
-						//next[c] = curr[c] + diff[c]*(curr[n] + curr[s] + curr[e] + curr[w] - 4*curr[c])
-
-						// methode instable avec diffusion variable
-						//float sum_diff = diff[n] + diff[s] + diff[e] + diff[w];
-						//next[c] = curr[c] + sum_diff(diff[n]*curr[n] + diff[s]*curr[s] + diff[e]*curr[e] + diff[w]*curr[w] - sum_diff*curr[c])
-						float bidon = (diff[n] - diff[s])*(next[n] - next[s]) + (diff[e] - diff[w])*(next[e] - next[w]);
-						//bidon = 0.0;
-						next[c] = (curr[c] + bidon + diff[c]*(next[n] + next[s] + next[e] + next[w])) / (1 + 4 * diff[c]);
-					}
-				}
-				stripe_set_bounds(sa_next->stripes[k]);
-			}
-			#pragma omp for schedule(static, 1)
-			for(k=0; k < sa_next->len-1; k++) {
-				//printf("stripe_xchg_bounds\n");
-				stripe_t *s1 = sa_next->stripes[k];
-				stripe_t *s2 = sa_next->stripes[k+1];
-				stripe_xchg_bounds(s1, s2);
-			}
+	void *ptr;
+
+	if (posix_memalign(&ptr, CACHE_LINE, n * size) != 0)
+		return NULL;
+	return memset(ptr, 0, n * size);
+}
+
+static int sync_read(int *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+}
+
+static void sync_write(int *counter, int v)
+{
+	__atomic_store_n(counter, v, __ATOMIC_SEQ_CST);
+}
+
+/* spin until the counter reaches value, the neighbours are on other cores */
+static void sync_wait(int *counter, int value)
+{
+	int spin = 0;
+	while (sync_read(counter) < value) {
+		if (++spin == SPIN_YIELD) {
+			sched_yield();
+			spin = 0;
 		}
 	}
-	foreach_stripe_0(sa_curr, stripe_set_bounds);
-	foreach_stripe_0(sa_next, stripe_set_bounds);
 }
 
-/* assume each stripe array have the same number of stripes and they have
- * the same size */
-void set_heat(stripe_array_t *curr, stripe_array_t *heat)
+/* one Gauss-Seidel sweep of the inner cells of a stripe */
+static void diffusion_sweep(stripe_t *scurr, stripe_t *snext, stripe_t *sdiff)
 {
-	int i, j, s, a;
-	stripe_t scurr, sheat;
-	if (curr == NULL || heat == NULL)
-		return;
-	for (s=0; s < curr->len; s++) {
-		scurr = *curr->stripes[s];
-		sheat = *heat->stripes[s];
-		a = scurr.width * scurr.height;
-		for (i=0; i < a; i++) {
-			if (scurr.data[i] < sheat.data[i])
-				scurr.data[i] = sheat.data[i];
+	int i, j;
+	float *curr = scurr->data;
+	float *next = snext->data;
+	float *diff = sdiff->data;
+	int width = scurr->width;
+	int height = scurr->height;
+
+	for(j=1; j < height - 1; j++) {
+		for (i = 1; i < width - 1; i++) {
+			int c =	IX(i, j, width);
+			int n = IX(i, j-1, width);
+			int s = IX(i, j+1, width);
+			int w = IX(i-1, j, width);
+			int e = IX(i+1, j, width);
+			// epic fail
+			//float sum_diff = diff[n] + diff[s] + diff[e] + diff[w];
+			//next[c] = (curr[c] + diff[n] * next[n] + diff[s] * next[s] + diff[e] * next[e] + diff[w] * next[w]) / (1 + 4 * sum_diff);
+
+			// ok, mais facteur de diffusion cst
+			//next[c] = (curr[c] + diff[c]*(next[n] + next[s] + next[e] + next[w])) / (1 + 4 * diff[c]);
+
+			// methode instable avec diffusion cst
+			//next[c] = curr[c] + diff[c]*(curr[n] + curr[s] + curr[e] + curr[w] - 4*curr[c])
+
+			// methode instable avec diffusion variable
+			//float sum_diff = diff[n] + diff[s] + diff[e] + diff[w];
+			//next[c] = curr[c] + sum_diff(diff[n]*curr[n] + diff[s]*curr[s] + diff[e]*curr[e] + diff[w]*curr[w] - sum_diff*curr[c])
+			float bidon = (diff[n] - diff[s])*(next[n] - next[s]) + (diff[e] - diff[w])*(next[e] - next[w]);
+			//bidon = 0.0;
+			next[c] = (curr[c] + bidon + diff[c]*(next[n] + next[s] + next[e] + next[w])) / (1 + 4 * diff[c]);
 		}
 	}
+	stripe_set_side_bounds(snext);
 }
 
-void fix_heat(stripe_array_t *curr, stripe_array_t *next)
+/*
+ * Sweeps of stripe k, called by its thread inside the parallel region of
+ * do_simulate(). Before sweep g the stripe waits for its neighbours to
+ * finish sweep g-1 and copies their edge lines into its paddings; it
+ * then waits for them to have copied its own edge lines before it
+ * overwrites them. Only the two neighbours are waited for, and the
+ * result is the same as a barrier between the sweeps. The counters keep
+ * growing from one time step to the next, first is the index of the
+ * first sweep of this step.
+ */
+static void diffusion_stripe(stripe_array_t *sa_curr, stripe_array_t *sa_next,
+		stripe_array_t *sa_diff, struct stripe_sync *sync, int k, int first, int sweeps)
 {
-	float h1 = stripe_array_sum_inner(curr);
-	float h2 = stripe_array_sum_inner(next);
-	float fact = h1 / h2;
-	//printf("h1=%f h2=%f fact=%f\n", h1, h2, fact);
-	foreach_stripe_1(next, stripe_mul, fact);
+	int g;
+	int len = sa_next->len;
+	stripe_t *top = k > 0 ? sa_next->stripes[k-1] : NULL;
+	stripe_t *bot = k < len - 1 ? sa_next->stripes[k+1] : NULL;
+
+	for (g = first; g < first + sweeps; g++) {
+		if (top != NULL)
+			sync_wait(&sync[k-1].done, g);
+		if (bot != NULL)
+			sync_wait(&sync[k+1].done, g);
+		stripe_pull_bounds(sa_next->stripes[k], top, bot);
+		sync_write(&sync[k].pulled, g + 1);
+		if (top != NULL)
+			sync_wait(&sync[k-1].pulled, g + 1);
+		if (bot != NULL)
+			sync_wait(&sync[k+1].pulled, g + 1);
+		diffusion_sweep(sa_curr->stripes[k], sa_next->stripes[k], sa_diff->stripes[k]);
+		sync_write(&sync[k].done, g + 1);
+	}
 }
 
-void heat_sink(stripe_array_t *next, stripe_array_t *sink)
+/* the heat sources never cool down */
+static void set_heat(stripe_t *curr, stripe_t *heat)
 {
-	int i, j, s, w, h;
-	stripe_t snext, ssink;
+	int i, a;
+	if (curr == NULL || heat == NULL)
+		return;
+	a = curr->width * curr->height;
+	for (i=0; i < a; i++) {
+		if (curr->data[i] < heat->data[i])
+			curr->data[i] = heat->data[i];
+	}
+}
+
+void heat_sink(stripe_t *next, stripe_t *sink)
+{
+	int i, j, w, h;
 	if (next == NULL || sink == NULL)
 		return;
-	for (s=0; s < next->len; s++) {
-		snext = *next->stripes[s];
-		ssink = *sink->stripes[s];
-		w = snext.width;
-		h = snext.height;
-		for(j=1; j < h-1; j++) {
-			for(i=1; i < w-1; i++) {
-				int index = IX(i,j,w);
-				if (snext.data[index] > 0.0f) {
-					snext.data[index] -= snext.data[index] * ssink.data[index];
-				}
+	w = next->width;
+	h = next->height;
+	for(j=1; j < h-1; j++) {
+		for(i=1; i < w-1; i++) {
+			int index = IX(i,j,w);
+			if (next->data[index] > 0.0f) {
+				next->data[index] -= next->data[index] * sink->data[index];
 			}
 		}
 	}
 }
 
+/*
+ * Inner sums of the stripes, for the conservation of the heat in fix_heat,
+ * one cache line per stripe
+ */
+struct heat_sums {
+	float curr;
+	float next;
+	char pad[CACHE_LINE - 2 * sizeof(float)];
+};
+
+/*
+ * One thread per stripe for the whole simulation: the layers must be
+ * split in as many stripes as there are threads in the team. The sweeps
+ * only synchronize neighbours, the total heat is the one full barrier
+ * of a time step.
+ */
 int do_simulate(struct layers *l, params_t *params)
 {
-	int i,j,k,t,x,y,w,h;
+	int t, len, sweeps, ret = 0;
 	params_t p;
+	struct stripe_sync *sync = NULL;
+	struct heat_sums *sums = NULL;
 	if (l == NULL || params == NULL)
 		return -1;
 	p = *params;
@@ -137,83 +200,198 @@ int do_simulate(struct layers *l, params_t *params)
 	stripe_array_t *mat1 = l->layers[LAYER_MAT1];
 	stripe_array_t *mat2 = l->layers[LAYER_MAT2];
 
-	foreach_stripe_0(diff, dump_stripe);
-
 	foreach_stripe_1(heat, stripe_mul, p.max_heat);
 	foreach_stripe_1(diff, stripe_mul, p.max_diff);
 	foreach_stripe_1(sink, stripe_mul, p.max_sink);
 	foreach_stripe_1(mat1, stripe_set_all, 0.0);
 	foreach_stripe_1(mat2, stripe_set_all, 0.0);
-	//dump_layers(l);
-	stripe_array_t *curr = mat1;
-	stripe_array_t *next = mat2;
-
-	for(t=0; t < p.iter; t++) {
-		set_heat(curr, heat);
-		diffusion_1(curr, next, diff);
-		fix_heat(curr, next);
-		//heat_sink(next, sink);
-		SWAP(curr, next);
-		printf("%d\n", t);
-		//foreach_stripe_0(curr, dump_stripe);
+
+	len = mat1->len;
+	sweeps = 20 + len;
+	sync = calloc_lines(len, sizeof(struct stripe_sync));
+	/* two sets, so that step t+1 does not overwrite the sums step t is reading */
+	sums = calloc_lines(2 * len, sizeof(struct heat_sums));
+	if (sync == NULL || sums == NULL)
+		goto err;
+
+	#pragma omp parallel num_threads(len) private(t)
+	{
+		int i, k = omp_get_thread_num();
+		stripe_array_t *curr = mat1;
+		stripe_array_t *next = mat2;
+		struct heat_sums *s;
+		float h1, h2;
+
+		if (omp_get_num_threads() != len) {
+			#pragma omp single
+			ret = -1;
+		}
+		#pragma omp barrier
+		for(t=0; ret == 0 && t < p.iter; t++) {
+			set_heat(curr->stripes[k], heat->stripes[k]);
+			diffusion_stripe(curr, next, diff, sync, k, t * sweeps, sweeps);
+			s = &sums[(t % 2) * len];
+			s[k].curr = stripe_sum_inner(curr->stripes[k]);
+			s[k].next = stripe_sum_inner(next->stripes[k]);
+			#pragma omp barrier
+			/* fix_heat: every thread adds the sums in the same order */
+			h1 = h2 = 0.0;
+			for (i=0; i < len; i++) {
+				h1 += s[i].curr;
+				h2 += s[i].next;
+			}
+			stripe_mul(next->stripes[k], h1 / h2);
+			//heat_sink(next->stripes[k], sink->stripes[k]);
+			SWAP(curr, next);
+		}
+	}
+	if (ret < 0) {
+		fprintf(stderr, "do_simulate: %d stripes but fewer threads\n", len);
+		goto err;
 	}
 
-	return 0;
+done:
+	free(sync);
+	free(sums);
+	return ret;
+err:
+	ret = -1;
+	goto done;
 }
 
 int save_stripe_to_image(char *path, stripe_array_t *a, float max)
 {
 	int i, j, k, w, h, area;
+	int interval = get_color_interval(max);
+	float interval_inv = get_color_interval_inv(max);
 	stripe_t s;
 	if (a == NULL)
 		return -1;
 	stripe_array_trimmed_size(a, &w, &h);
 	area = w * h;
 	struct rgb *image = (struct rgb *) calloc(area, sizeof(struct rgb));
+	if (image == NULL)
+		return -1;
 
 	for (k=0; k < a->len; k++) {
 		s = *a->stripes[k];
 		for(j=1; j < s.height - 1; j++) {
 			for (i=1; i < s.width-1; i++) {
 				int c = IX(i,j,s.width);
-				value_color(&image[c], s.data[c], max);
+				value_color(&image[c], s.data[c], interval, interval_inv);
 			}
 		}
 	}
 
-	save_image("out.ppm", image, w, h);
+	save_image(path, image, w, h);
 	FREE(image);
 	return 0;
 }
 
-int cmd_simulate(char *path)
+/*
+ * Run the simulation of path once for each thread count, the layers are
+ * split in one stripe per thread. Returns the seconds taken by
+ * do_simulate(), the load of the png is not timed.
+ */
+double cmd_simulate(char *path, char *output, params_t *p, int num_threads)
 {
+	double t0, t1 = -1.0;
 	struct layers *l = NULL;
 	if (init_layers(path, &l) < 0) {
-		printf("error\n");
+		fprintf(stderr, "%s: cannot load the layers\n", path);
+		goto done;
 	}
-	//dump_layers(l);
-	//return 0;
-	/* split layers, one for each thread */
-	int num_threads = 1;
-	omp_set_num_threads(num_threads);
 	split_layers(l, num_threads);
-	params_t p;
-	p.iter = 100;
-	p.max_heat = 100.0;
-	p.max_diff = 10;
-	p.max_sink = 0.1;
-	do_simulate(l, &p);
+	t0 = omp_get_wtime();
+	if (do_simulate(l, p) < 0)
+		goto done;
+	t1 = omp_get_wtime() - t0;
 	merge_layers(l);
-	//foreach_stripe_0(l->layers[LAYER_MAT2], dump_stripe);
-	save_stripe_to_image("out.ppm", l->layers[LAYER_MAT2], p.max_heat);
+	if (output != NULL)
+		save_stripe_to_image(output, l->layers[LAYER_MAT2], p->max_heat);
+done:
 	free_layers(l);
-	l = NULL;
-	return 0;
+	return t1;
+}
+
+#define MAX_RUNS 64
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: heat [OPTIONS] image.png\n"
+		"  -t, --threads N[,N...]  thread counts to run, one stripe per thread (1)\n"
+		"  -i, --iter N            time steps (100)\n"
+		"  -o, --output FILE       ppm of the last run\n"
+		"  -h, --help              this help\n");
 }
 
 int main(int argc, char **argv)
 {
-	//cmd_simulate(argv[1]);
+	int i, opt, runs = 0;
+	int threads[MAX_RUNS];
+	double secs[MAX_RUNS];
+	char *output = NULL, *tok, *list = NULL;
+	params_t p;
+	p.iter = 100;
+	p.max_heat = 100.0;
+	p.max_diff = 10;
+	p.max_sink = 0.1;
+
+	struct option options[] = {
+		{ "threads", 1, 0, 't' },
+		{ "iter", 1, 0, 'i' },
+		{ "output", 1, 0, 'o' },
+		{ "help", 0, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "t:i:o:h", options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			list = optarg;
+			break;
+		case 'i':
+			p.iter = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	if (list == NULL) {
+		threads[runs++] = 1;
+	} else {
+		for (tok = strtok(list, ","); tok != NULL && runs < MAX_RUNS; tok = strtok(NULL, ",")) {
+			threads[runs] = atoi(tok);
+			if (threads[runs] < 1) {
+				fprintf(stderr, "invalid thread count: %s\n", tok);
+				return 1;
+			}
+			runs++;
+		}
+	}
+
+	for (i=0; i < runs; i++) {
+		/* only the last run is written, the stripes change the result slightly */
+		secs[i] = cmd_simulate(argv[optind], i == runs - 1 ? output : NULL, &p, threads[i]);
+		if (secs[i] < 0)
+			return 1;
+	}
+
+	printf("threads,seconds,speedup,efficiency\n");
+	for (i=0; i < runs; i++) {
+		double speedup = secs[0] / secs[i];
+		printf("%d,%.3f,%.2f,%.2f\n", threads[i], secs[i], speedup,
+				speedup * threads[0] / threads[i]);
+	}
 	return 0;
 }
@@ -14,7 +14,7 @@
 
 #include "layer.h"
 #include "stripe.h"
-#include "util.h"
+#include "memory.h"
 
 const int NUM_LAYERS = LAYER_MAT2 + 1;
 
@@ -370,6 +370,9 @@ void split_layers(layers_t *layers, int nb)
 		stripe_array_t *b = NULL;
 		stripe_split(a->stripes[0], &b, nb);
 		foreach_stripe_0(b, stripe_set_bounds);
+		/* the paddings between stripes hold the lines of the neighbours */
+		for (j=0; j < b->len - 1; j++)
+			stripe_xchg_bounds(b->stripes[j], b->stripes[j+1]);
 		layers->layers[i] = b;
 		free_stripe_array(a);
 	}
@@ -1,41 +1,601 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+#include "solver.h"
+
 #define IX(i,j) ((i)+(N+2)*(j))
 #define SWAP(x0,x) {float * tmp=x0;x0=x;x=tmp;}
-#define FOR_EACH_CELL for ( i=1 ; i<=N ; i++ ) { for ( j=1 ; j<=N ; j++ ) {
+/* rows outer: i is the unit stride index, and the rows are shared among the threads */
+#define FOR_EACH_CELL for ( j=1 ; j<=N ; j++ ) { for ( i=1 ; i<=N ; i++ ) {
 #define END_FOR }}
 
+#define LIN_SOLVE_ITER 20
+/* below this grid size the sweeps are not worth a parallel region */
+#define RELAX_PARALLEL_MIN 64
+
+/* multigrid: sweeps before and after the coarse correction, on the coarsest grid */
+#define MG_PRE_SWEEPS 2
+#define MG_POST_SWEEPS 2
+#define MG_COARSE_SWEEPS 50
+#define MG_COARSEST 4
+#define MG_MAX_LEVELS 16
+
+/* fields fluid_step() advects in one pass, beyond it falls back to one at a time */
+#define ADVECT_MAX_FIELDS 8
+
 void add_source ( int N, float * x, float * s, float dt )
 {
 	int i, size=(N+2)*(N+2);
+	#pragma omp parallel for schedule(static)
 	for ( i=0 ; i<size ; i++ ) x[i] += dt*s[i];
 }
 
-void set_bnd ( int N, int b, float * x )
+/*
+ * Orphaned worksharing: inside a parallel region the edges are shared by
+ * the team, outside of one the calling thread does everything.
+ */
+static void set_bnd_team ( int N, int b, float * x )
 {
 	int i;
-	//#pragma omp parallel for
+	#pragma omp for schedule(static)
 	for ( i=1 ; i<=N ; i++ ) {
 		x[IX(0  ,i)] = b==1 ? -x[IX(1,i)] : x[IX(1,i)];
 		x[IX(N+1,i)] = b==1 ? -x[IX(N,i)] : x[IX(N,i)];
 		x[IX(i,0  )] = b==2 ? -x[IX(i,1)] : x[IX(i,1)];
 		x[IX(i,N+1)] = b==2 ? -x[IX(i,N)] : x[IX(i,N)];
 	}
-	x[IX(0  ,0  )] = 0.5f*(x[IX(1,0  )]+x[IX(0  ,1)]);
-	x[IX(0  ,N+1)] = 0.5f*(x[IX(1,N+1)]+x[IX(0  ,N)]);
-	x[IX(N+1,0  )] = 0.5f*(x[IX(N,0  )]+x[IX(N+1,1)]);
-	x[IX(N+1,N+1)] = 0.5f*(x[IX(N,N+1)]+x[IX(N+1,N)]);
+	#pragma omp single
+	{
+		x[IX(0  ,0  )] = 0.5f*(x[IX(1,0  )]+x[IX(0  ,1)]);
+		x[IX(0  ,N+1)] = 0.5f*(x[IX(1,N+1)]+x[IX(0  ,N)]);
+		x[IX(N+1,0  )] = 0.5f*(x[IX(N,0  )]+x[IX(N+1,1)]);
+		x[IX(N+1,N+1)] = 0.5f*(x[IX(N,N+1)]+x[IX(N+1,N)]);
+	}
+}
+
+void set_bnd ( int N, int b, float * x )
+{
+	#pragma omp parallel
+	set_bnd_team ( N, b, x );
+}
+
+static inline float residual_cell ( int N, int i, int j, const float * p, const float * rhs )
+{
+	return ( rhs[IX(i,j)] - (4*p[IX(i,j)] - p[IX(i-1,j)]-p[IX(i+1,j)]-p[IX(i,j-1)]-p[IX(i,j+1)]) );
+}
+
+/*
+ * The sums over the grid are taken in float along a row, which lets the
+ * compiler vectorize, and the rows are added in double in row order by
+ * one thread: a reduction clause would add them in an order that depends
+ * on the number of threads, and so would the results of the solvers.
+ */
+static double sum_rows ( int N, const double * rows )
+{
+	int j;
+	double sum = 0;
+
+	for ( j=1 ; j<=N ; j++ ) sum += rows[j];
+	return ( sum );
+}
+
+/*
+ * |rhs - A p|^2 over row j, the walls of p taken as mirrored (b=0)
+ * rather than read: the sweep that calls it sets them afterwards.
+ */
+static float residual_row ( int N, int j, const float * p, const float * rhs )
+{
+	const float * c = &p[IX(0,j)], * f = &rhs[IX(0,j)];
+	const float * d = j>1 ? c-(N+2) : c, * u = j<N ? c+(N+2) : c;
+	float r, row = 0;
+	int i;
+
+	#pragma omp simd reduction(+:row)
+	for ( i=2 ; i<N ; i++ ) {
+		float ri = f[i] - (4*c[i] - c[i-1]-c[i+1]-d[i]-u[i]);
+		row += ri*ri;
+	}
+	r = f[1] - (4*c[1] - c[1]-c[N>1 ? 2 : 1]-d[1]-u[1]);
+	row += r*r;
+	if ( N>1 ) {
+		r = f[N] - (4*c[N] - c[N-1]-c[N]-d[N]-u[N]);
+		row += r*r;
+	}
+	return ( row );
+}
+
+/* Gauss-Seidel update of the cells of row j with (i+j)%2 == color */
+static inline void relax_row ( int N, int j, int color, float * x, const float * x0,
+		float a, float inv_c )
+{
+	int i;
+	for ( i=2-((j+color)&1) ; i<=N ; i+=2 )
+		x[IX(i,j)] = (x0[IX(i,j)] + a*(x[IX(i-1,j)]+x[IX(i+1,j)]+x[IX(i,j-1)]+x[IX(i,j+1)]))*inv_c;
+}
+
+/*
+ * Red-black Gauss-Seidel: the red cells ((i+j) even) only read black
+ * neighbours and the other way around, so each half sweep is parallel
+ * and the result does not depend on the number of threads.
+ *
+ * Every thread owns a block of rows and fuses the two half sweeps: the
+ * black cells of row j-1 are relaxed right after the red cells of row j,
+ * while row j-1 is still in cache, so a sweep streams the grid once
+ * instead of twice. The first and last black rows of a block are read by
+ * the red half sweep of the neighbouring blocks, they wait for the
+ * barrier. All the sweeps run in one parallel region.
+ *
+ * With res, the last sweep also returns the residual |x0 - A x|^2 of the
+ * pressure equation (b=0, a=1, c=4): a row is final two rows behind the
+ * red half sweep, its residual is taken then, while it is still in
+ * cache, and the first and last two rows of a block after the barrier.
+ */
+static void relax ( int N, int b, float * x, const float * x0, float a, float c, int iter, double * res )
+{
+	float inv_c = 1.0f/c;
+	double rows[N+1];
+
+	#pragma omp parallel if(N >= RELAX_PARALLEL_MIN)
+	{
+		int k, j;
+		int id = omp_get_thread_num();
+		int n = omp_get_num_threads();
+		int j0 = 1 + (int) ((long) N*id/n);
+		int j1 = 1 + (int) ((long) N*(id+1)/n);
+
+		for ( k=0 ; k<iter ; k++ ) {
+			int last = res && k==iter-1;
+			for ( j=j0 ; j<j1 ; j++ ) {
+				relax_row ( N, j, 0, x, x0, a, inv_c );
+				if ( j-1 > j0 )
+					relax_row ( N, j-1, 1, x, x0, a, inv_c );
+				if ( last && j-3 > j0 )
+					rows[j-2] = residual_row ( N, j-2, x, x0 );
+			}
+			#pragma omp barrier
+			if ( j1-1 > j0 )
+				relax_row ( N, j1-1, 1, x, x0, a, inv_c );
+			if ( j1 > j0 )
+				relax_row ( N, j0, 1, x, x0, a, inv_c );
+			#pragma omp barrier
+			if ( last ) {
+				for ( j=j0 ; j<j1 && j<j0+2 ; j++ )
+					rows[j] = residual_row ( N, j, x, x0 );
+				for ( j=j1-2>j0+2 ? j1-2 : j0+2 ; j<j1 ; j++ )
+					rows[j] = residual_row ( N, j, x, x0 );
+			}
+			set_bnd_team ( N, b, x );
+		}
+	}
+	if ( res && iter>0 )
+		*res = sum_rows ( N, rows );
 }
 
 void lin_solve ( int N, int b, float * x, float * x0, float a, float c )
 {
+	relax ( N, b, x, x0, a, c, LIN_SOLVE_ITER, NULL );
+}
+
+/*
+ * Pressure solvers of project(): they solve 4p - (sum of the 4 neighbours)
+ * = div with p mirrored on the walls (set_bnd b=0), and run until the
+ * residual falls under tol times the norm of div, or max_iter iterations.
+ * The Gauss-Seidel reference always runs max_iter sweeps, its residual
+ * is only measured. They return the squared residual in *res and |div|^2
+ * in *b2, which they need anyway for the stopping test.
+ */
+static struct {
+	int solver;
+	float tol;
+	int max_iter;
+	struct pressure_stats stats;
+} pressure = { PRESSURE_MG, 1e-3f, 0, { 0, 0, 0.0f } };
+
+/* max_iter when the caller leaves it to 0 */
+static const int pressure_max_iter[] = {
+	[PRESSURE_GS] = LIN_SOLVE_ITER,
+	[PRESSURE_CG] = 20,
+	[PRESSURE_MG] = 20,
+};
+
+static const char * pressure_names[] = {
+	[PRESSURE_GS] = "gs",
+	[PRESSURE_CG] = "cg",
+	[PRESSURE_MG] = "mg",
+};
+
+#define NR_PRESSURE (int) (sizeof(pressure_names) / sizeof(pressure_names[0]))
+
+int pressure_lookup ( const char * name )
+{
+	int i;
+	for ( i=0 ; i<NR_PRESSURE ; i++ )
+		if ( strcmp ( pressure_names[i], name )==0 ) return ( i );
+	return ( -1 );
+}
+
+const char * pressure_name ( int solver )
+{
+	if ( solver<0 || solver>=NR_PRESSURE ) return ( "unknown" );
+	return ( pressure_names[solver] );
+}
+
+int pressure_config ( int solver, float tol, int max_iter )
+{
+	if ( solver<0 || solver>=NR_PRESSURE || tol<0 || max_iter<0 ) return ( -1 );
+	pressure.solver = solver;
+	pressure.tol = tol;
+	pressure.max_iter = max_iter;
+	return ( 0 );
+}
+
+void pressure_stats ( struct pressure_stats * st )
+{
+	*st = pressure.stats;
+	memset ( &pressure.stats, 0, sizeof(pressure.stats) );
+}
+
+/* |rhs - A p|^2, and |rhs|^2 in *b2 if not NULL, the walls of p must be set */
+static double residual ( int N, const float * p, const float * rhs, double * b2 )
+{
+	int i, j;
+	double rows[N+1], rows_b2[N+1];
+
+	#pragma omp parallel for private(i) schedule(static) if(N >= RELAX_PARALLEL_MIN)
+	for ( j=1 ; j<=N ; j++ ) {
+		float row = 0, row_b2 = 0;
+		#pragma omp simd reduction(+:row,row_b2)
+		for ( i=1 ; i<=N ; i++ ) {
+			float r = residual_cell ( N, i, j, p, rhs );
+			row += r*r;
+			row_b2 += rhs[IX(i,j)]*rhs[IX(i,j)];
+		}
+		rows[j] = row;
+		rows_b2[j] = row_b2;
+	}
+	if ( b2 )
+		*b2 = sum_rows ( N, rows_b2 );
+	return ( sum_rows ( N, rows ) );
+}
+
+static double norm2 ( int N, const float * x )
+{
+	int i, j;
+	double rows[N+1];
+
+	#pragma omp parallel for private(i) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		float row = 0;
+		#pragma omp simd reduction(+:row)
+		for ( i=1 ; i<=N ; i++ ) row += x[IX(i,j)]*x[IX(i,j)];
+		rows[j] = row;
+	}
+	return ( sum_rows ( N, rows ) );
+}
+
+/*
+ * The walls make A singular (p + constant is also a solution) and div
+ * has no reason to sum to zero on the grid: take its mean out, so that a
+ * solution exists and the residual can go to zero. The gradient of p,
+ * all project() uses, is the least squares one.
+ */
+static void remove_mean ( int N, float * x )
+{
+	int i, j;
+	double rows[N+1];
+	float mean;
+
+	#pragma omp parallel for private(i) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		double row = 0;
+		for ( i=1 ; i<=N ; i++ ) row += x[IX(i,j)];
+		rows[j] = row;
+	}
+	mean = (float) (sum_rows ( N, rows )/((double) N*N));
+	#pragma omp parallel for private(i) schedule(static)
+	FOR_EACH_CELL
+		x[IX(i,j)] -= mean;
+	END_FOR
+}
+
+/* scratch grids of the solvers, kept from one call to the next */
+static float * work_grid ( float ** grid, int * size, int N )
+{
+	if ( *size<(N+2)*(N+2) ) {
+		free ( *grid );
+		*grid = (float *) malloc ( (N+2)*(N+2)*sizeof(float) );
+		*size = *grid ? (N+2)*(N+2) : 0;
+	}
+	return ( *grid );
+}
+
+static int pressure_gs ( int N, float * p, float * div, float tol, int max_iter, double * res, double * b2 )
+{
+	(void) tol;
+	*b2 = norm2 ( N, div );
+	relax ( N, 0, p, div, 1, 4, max_iter, res );
+	return ( max_iter );
+}
+
+/*
+ * Cell centered multigrid V-cycle: red-black Gauss-Seidel smoothing, the
+ * residual of 4 fine cells summed into their coarse cell (the coarse
+ * cells are twice as wide, so A scales by 1/4) and bilinear
+ * interpolation of the coarse correction. The coarse grid of N is
+ * (N+1)/2 down to MG_COARSEST: with N odd, the last coarse row and column
+ * only cover one fine row or column, and only their residual is summed.
+ */
+struct mg_level {
+	int N;
+	float * p, * rhs;
+	int psize, rhssize;
+};
+
+static struct mg_level mg[MG_MAX_LEVELS];
+
+static inline int mg_coarse ( int N )
+{
+	return ( (N+1)/2 );
+}
+
+/* sum of the residual of fine row j over the fine cells of each coarse cell of rc */
+static inline void restrict_row ( int N, int j, float * rc, const float * p, const float * rhs )
+{
+	int i;
+	for ( i=1 ; i<=N/2 ; i++ )
+		rc[i] += residual_cell ( N, 2*i-1, j, p, rhs ) + residual_cell ( N, 2*i, j, p, rhs );
+	if ( N%2 )
+		rc[i] += residual_cell ( N, N, j, p, rhs );
+}
+
+/* rhs of the coarse grid: the residual of p, summed over the 4 cells of each coarse cell */
+static void restrict_residual ( int N, float * rc, const float * p, const float * rhs )
+{
+	int j, nc = mg_coarse ( N );
+
+	#pragma omp parallel for schedule(static) if(N >= RELAX_PARALLEL_MIN)
+	for ( j=1 ; j<=nc ; j++ ) {
+		float * r = &rc[(nc+2)*j];
+		memset ( r, 0, (nc+2)*sizeof(float) );
+		restrict_row ( N, 2*j-1, r, p, rhs );
+		if ( 2*j<=N )
+			restrict_row ( N, 2*j, r, p, rhs );
+	}
+}
+
+/*
+ * Fine row f += 3/4 of the coarse row c and 1/4 of the coarse row o next
+ * to it, each interpolated along the row the same way: a fine cell takes
+ * 9/16 of its coarse cell, 3/16 of the two coarse cells beside it and
+ * 1/16 of the diagonal one.
+ */
+static inline void prolong_row ( int N, float * restrict f, const float * c, const float * o )
+{
+	int i;
+	for ( i=1 ; i<=N/2 ; i++ ) {
+		f[2*i-1] += 0.75f*(0.75f*c[i]+0.25f*c[i-1])+0.25f*(0.75f*o[i]+0.25f*o[i-1]);
+		f[2*i]   += 0.75f*(0.75f*c[i]+0.25f*c[i+1])+0.25f*(0.75f*o[i]+0.25f*o[i+1]);
+	}
+	if ( N%2 )
+		f[N] += 0.75f*(0.75f*c[i]+0.25f*c[i-1])+0.25f*(0.75f*o[i]+0.25f*o[i-1]);
+}
+
+/* p += the correction pc of the coarse grid (walls set), then the walls of p */
+static void prolong_correction ( int N, float * p, const float * pc )
+{
+	int nc = mg_coarse ( N );
+
+	#pragma omp parallel if(N >= RELAX_PARALLEL_MIN)
+	{
+		int j;
+
+		#pragma omp for schedule(static)
+		for ( j=1 ; j<=nc ; j++ ) {
+			const float * c = &pc[(nc+2)*j];
+			prolong_row ( N, &p[IX(0,2*j-1)], c, c-(nc+2) );
+			if ( 2*j<=N )
+				prolong_row ( N, &p[IX(0,2*j)], c, c+(nc+2) );
+		}
+		set_bnd_team ( N, 0, p );
+	}
+}
+
+/* with res, the residual left by the last smoothing sweep of level l */
+static void vcycle ( int l, double * res )
+{
+	struct mg_level * f = &mg[l], * c = &mg[l+1];
+
+	if ( l+1>=MG_MAX_LEVELS || !c->N ) {
+		relax ( f->N, 0, f->p, f->rhs, 1, 4, MG_COARSE_SWEEPS, res );
+		return;
+	}
+	relax ( f->N, 0, f->p, f->rhs, 1, 4, MG_PRE_SWEEPS, NULL );
+	restrict_residual ( f->N, c->rhs, f->p, f->rhs );
+	memset ( c->p, 0, (c->N+2)*(c->N+2)*sizeof(float) );
+	vcycle ( l+1, NULL );
+	prolong_correction ( f->N, f->p, c->p );
+	relax ( f->N, 0, f->p, f->rhs, 1, 4, MG_POST_SWEEPS, res );
+}
+
+/* the coarse levels of the grid N, the finest one solves for p with rhs */
+static int mg_setup ( int N, float * p, float * rhs )
+{
+	int l, n = N;
+
+	mg[0].N = N;
+	mg[0].p = p;
+	mg[0].rhs = rhs;
+	for ( l=1 ; l<MG_MAX_LEVELS ; l++ ) {
+		if ( mg_coarse ( n )<MG_COARSEST ) {
+			mg[l].N = 0;
+			break;
+		}
+		n = mg_coarse ( n );
+		mg[l].N = n;
+		if ( !work_grid ( &mg[l].p, &mg[l].psize, n ) || !work_grid ( &mg[l].rhs, &mg[l].rhssize, n ) )
+			return ( -1 );
+	}
+	return ( 0 );
+}
+
+static int pressure_mg ( int N, float * p, float * div, float tol, int max_iter, double * res, double * b2 )
+{
+	double rr, stop;
+	int k;
+
+	if ( mg_setup ( N, p, div )<0 )
+		return ( -1 );
+	set_bnd ( N, 0, p );
+	rr = residual ( N, p, div, b2 );
+	stop = (double) tol*tol*(*b2);
+	for ( k=0 ; k<max_iter && rr>stop ; k++ )
+		vcycle ( 0, &rr );
+	*res = rr;
+	return ( k );
+}
+
+/*
+ * Conjugate gradient preconditioned by one V-cycle: z = M r is the
+ * V-cycle of A z = r from z = 0. The red-black smoothing makes M slightly
+ * unsymmetric, so beta is the flexible one, z_new.(r_new - r)/z.r, where
+ * r_new - r is -alpha q. A few iterations reach the tolerance where the
+ * V-cycles alone need more.
+ */
+
+/* q = A d, returns d.q */
+static double apply_a ( int N, float * q, float * d )
+{
+	int i, j;
+	double rows[N+1];
+
+	set_bnd ( N, 0, d );
+	#pragma omp parallel for private(i) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		float row = 0;
+		#pragma omp simd reduction(+:row)
+		for ( i=1 ; i<=N ; i++ ) {
+			q[IX(i,j)] = 4*d[IX(i,j)] - d[IX(i-1,j)]-d[IX(i+1,j)]-d[IX(i,j-1)]-d[IX(i,j+1)];
+			row += d[IX(i,j)]*q[IX(i,j)];
+		}
+		rows[j] = row;
+	}
+	return ( sum_rows ( N, rows ) );
+}
+
+/* z = M r, returns r.z and *zq = z.q */
+static double precondition ( int N, float * z, float * r, const float * q, double * zq )
+{
+	int i, j;
+	double rows_rz[N+1], rows_zq[N+1];
+
+	memset ( z, 0, (N+2)*(N+2)*sizeof(float) );
+	mg[0].p = z;
+	mg[0].rhs = r;
+	vcycle ( 0, NULL );
+	#pragma omp parallel for private(i) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		float row_rz = 0, row_zq = 0;
+		#pragma omp simd reduction(+:row_rz,row_zq)
+		for ( i=1 ; i<=N ; i++ ) {
+			row_rz += r[IX(i,j)]*z[IX(i,j)];
+			row_zq += z[IX(i,j)]*q[IX(i,j)];
+		}
+		rows_rz[j] = row_rz;
+		rows_zq[j] = row_zq;
+	}
+	*zq = sum_rows ( N, rows_zq );
+	return ( sum_rows ( N, rows_rz ) );
+}
+
+static int pressure_cg ( int N, float * p, float * div, float tol, int max_iter, double * res, double * b2 )
+{
+	static float * r, * d, * q, * z;
+	static int rsize, dsize, qsize, zsize;
+	double rz, rz_new, zq, rr, stop;
+	double rows[N+1], rows_b2[N+1];
+	float alpha, beta;
 	int i, j, k;
 
-	for ( k=0 ; k<20 ; k++ ) {
-		//#pragma omp parallel for private(i,j)
+	if ( !work_grid ( &r, &rsize, N ) || !work_grid ( &d, &dsize, N ) ||
+			!work_grid ( &q, &qsize, N ) || !work_grid ( &z, &zsize, N ) ||
+			mg_setup ( N, z, r )<0 )
+		return ( -1 );
+
+	set_bnd ( N, 0, p );
+	#pragma omp parallel for private(i) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		float row = 0, row_b2 = 0;
+		#pragma omp simd reduction(+:row,row_b2)
+		for ( i=1 ; i<=N ; i++ ) {
+			r[IX(i,j)] = residual_cell ( N, i, j, p, div );
+			q[IX(i,j)] = 0;
+			row += r[IX(i,j)]*r[IX(i,j)];
+			row_b2 += div[IX(i,j)]*div[IX(i,j)];
+		}
+		rows[j] = row;
+		rows_b2[j] = row_b2;
+	}
+	rr = sum_rows ( N, rows );
+	*b2 = sum_rows ( N, rows_b2 );
+	stop = (double) tol*tol*(*b2);
+	rz = precondition ( N, z, r, q, &zq );
+	memcpy ( d, z, (N+2)*(N+2)*sizeof(float) );
+
+	for ( k=0 ; k<max_iter && rr>stop ; k++ ) {
+		alpha = (float) (rz/apply_a ( N, q, d ));
+		#pragma omp parallel for private(i) schedule(static)
+		for ( j=1 ; j<=N ; j++ ) {
+			float row = 0;
+			#pragma omp simd reduction(+:row)
+			for ( i=1 ; i<=N ; i++ ) {
+				p[IX(i,j)] += alpha*d[IX(i,j)];
+				r[IX(i,j)] -= alpha*q[IX(i,j)];
+				row += r[IX(i,j)]*r[IX(i,j)];
+			}
+			rows[j] = row;
+		}
+		rr = sum_rows ( N, rows );
+		if ( rr<=stop ) {
+			k++;
+			break;
+		}
+		rz_new = precondition ( N, z, r, q, &zq );
+		beta = (float) (-alpha*zq/rz);
+		rz = rz_new;
+		#pragma omp parallel for private(i) schedule(static)
 		FOR_EACH_CELL
-			x[IX(i,j)] = (x0[IX(i,j)] + a*(x[IX(i-1,j)]+x[IX(i+1,j)]+x[IX(i,j-1)]+x[IX(i,j+1)]))/c;
+			d[IX(i,j)] = z[IX(i,j)] + beta*d[IX(i,j)];
 		END_FOR
-		set_bnd ( N, b, x );
 	}
+	set_bnd ( N, 0, p );
+	*res = rr;
+	return ( k );
+}
+
+static int (* const pressure_solvers[]) ( int N, float * p, float * div, float tol, int max_iter,
+		double * res, double * b2 ) = {
+	[PRESSURE_GS] = pressure_gs,
+	[PRESSURE_CG] = pressure_cg,
+	[PRESSURE_MG] = pressure_mg,
+};
+
+float divergence ( int N, float * u, float * v )
+{
+	int i, j;
+	double rows[N+1], d;
+
+	#pragma omp parallel for private(i,d) schedule(static)
+	for ( j=1 ; j<=N ; j++ ) {
+		double row = 0;
+		for ( i=1 ; i<=N ; i++ ) {
+			d = 0.5*(u[IX(i+1,j)]-u[IX(i-1,j)]+v[IX(i,j+1)]-v[IX(i,j-1)]);
+			row += d*d;
+		}
+		rows[j] = row;
+	}
+	return ( (float) sqrt ( sum_rows ( N, rows )/((double) N*N) ) );
 }
 
 void diffuse ( int N, int b, float * x, float * x0, float diff, float dt )
@@ -44,38 +604,110 @@ void diffuse ( int N, int b, float * x, float * x0, float diff, float dt )
 	lin_solve ( N, b, x, x0, a, 1+4*a );
 }
 
+/* departure cell and weights of the cells of row j */
+static void backtrace_row ( int N, int j, float dt0, const float * restrict u, const float * restrict v,
+		int * restrict idx, float * restrict s1, float * restrict t1 )
+{
+	int i;
+
+	#pragma omp simd
+	for ( i=1 ; i<=N ; i++ ) {
+		float x = i-dt0*u[IX(i,j)], y = j-dt0*v[IX(i,j)];
+		int i0, j0;
+		x = x<0.5f ? 0.5f : x; x = x>N+0.5f ? N+0.5f : x; i0 = (int) x;
+		y = y<0.5f ? 0.5f : y; y = y>N+0.5f ? N+0.5f : y; j0 = (int) y;
+		idx[i-1] = IX(i0,j0); s1[i-1] = x-i0; t1[i-1] = y-j0;
+	}
+}
+
+static void gather_row ( int N, float * restrict d, const float * restrict d0,
+		const int * restrict idx, const float * restrict s1, const float * restrict t1 )
+{
+	int i;
+
+	#pragma omp simd
+	for ( i=0 ; i<N ; i++ ) {
+		float s0 = 1-s1[i], t0 = 1-t1[i];
+		d[i] = s0*(t0*d0[idx[i]]+t1[i]*d0[idx[i]+N+2])+
+			   s1[i]*(t0*d0[idx[i]+1]+t1[i]*d0[idx[i]+N+3]);
+	}
+}
+
+/*
+ * Semi-Lagrangian advection of n fields d0[k] into d[k] (walls b[k]) by
+ * the same velocity (u, v). The backtrace is computed once per cell, a
+ * row at a time into small per-thread arrays, then every field gathers
+ * its 4 neighbours from them: u and v are read once whatever the number
+ * of fields. Both row loops vectorize (the second one with gathers).
+ */
+void advect_fields ( int N, int n, const int * b, float ** d, float ** d0, float * u, float * v, float dt )
+{
+	float dt0 = dt*N;
+
+	#pragma omp parallel
+	{
+		int j, k;
+		int idx[N];
+		float s1[N], t1[N];
+
+		#pragma omp for schedule(static)
+		for ( j=1 ; j<=N ; j++ ) {
+			backtrace_row ( N, j, dt0, u, v, idx, s1, t1 );
+			for ( k=0 ; k<n ; k++ )
+				gather_row ( N, &d[k][IX(1,j)], d0[k], idx, s1, t1 );
+		}
+		for ( k=0 ; k<n ; k++ )
+			set_bnd_team ( N, b[k], d[k] );
+	}
+}
+
 void advect ( int N, int b, float * d, float * d0, float * u, float * v, float dt )
 {
-	int i, j, i0, j0, i1, j1;
-	float x, y, s0, t0, s1, t1, dt0;
+	advect_fields ( N, 1, &b, &d, &d0, u, v, dt );
+}
 
-	dt0 = dt*N;
-	//#pragma omp parallel for private(i,j,i0,i1,j0,x,y,s0,s1,t0,t1)
-	FOR_EACH_CELL
-		x = i-dt0*u[IX(i,j)]; y = j-dt0*v[IX(i,j)];
-		if (x<0.5f) x=0.5f; if (x>N+0.5f) x=N+0.5f; i0=(int)x; i1=i0+1;
-		if (y<0.5f) y=0.5f; if (y>N+0.5f) y=N+0.5f; j0=(int)y; j1=j0+1;
-		s1 = x-i0; s0 = 1-s1; t1 = y-j0; t0 = 1-t1;
-		d[IX(i,j)] = s0*(t0*d0[IX(i0,j0)]+t1*d0[IX(i0,j1)])+
-					 s1*(t0*d0[IX(i1,j0)]+t1*d0[IX(i1,j1)]);
-	END_FOR
-	set_bnd ( N, b, d );
+/* compulsory traffic: u and v, the field read (once, the gathers hit in cache) and written */
+double advect_bytes ( int N, int n, int fused )
+{
+	double cells = (double) N*N;
+
+	if ( fused ) return ( (2+2*n)*cells*sizeof(float) );
+	return ( 4*n*cells*sizeof(float) );
+}
+
+static void pressure_solve ( int N, float * p, float * div )
+{
+	int max_iter = pressure.max_iter ? pressure.max_iter : pressure_max_iter[pressure.solver];
+	double res = 0, b2 = 0;
+	int iter;
+
+	iter = pressure_solvers[pressure.solver] ( N, p, div, pressure.tol, max_iter, &res, &b2 );
+	if ( iter<0 ) {
+		/* out of memory for the scratch grids */
+		lin_solve ( N, 0, p, div, 1, 4 );
+		iter = LIN_SOLVE_ITER;
+	}
+	pressure.stats.calls++;
+	pressure.stats.iterations += iter;
+	if ( b2>0 && sqrt ( res/b2 )>pressure.stats.residual )
+		pressure.stats.residual = (float) sqrt ( res/b2 );
 }
 
 void project ( int N, float * u, float * v, float * p, float * div )
 {
 	int i, j;
 
-	//#pragma omp parallel for private(i,j)
+	#pragma omp parallel for private(i,j) schedule(static)
 	FOR_EACH_CELL
 		div[IX(i,j)] = -0.5f*(u[IX(i+1,j)]-u[IX(i-1,j)]+v[IX(i,j+1)]-v[IX(i,j-1)])/N;
 		p[IX(i,j)] = 0;
 	END_FOR	
+	remove_mean ( N, div );
 	set_bnd ( N, 0, div ); set_bnd ( N, 0, p );
 
-	lin_solve ( N, 0, p, div, 1, 4 );
+	pressure_solve ( N, p, div );
 
-	//#pragma omp parallel for private(i,j)
+	#pragma omp parallel for private(i,j) schedule(static)
 	FOR_EACH_CELL
 		u[IX(i,j)] -= 0.5f*N*(p[IX(i+1,j)]-p[IX(i-1,j)]);
 		v[IX(i,j)] -= 0.5f*N*(p[IX(i,j+1)]-p[IX(i,j-1)]);
@@ -83,21 +715,87 @@ void project ( int N, float * u, float * v, float * p, float * div )
 	set_bnd ( N, 1, u ); set_bnd ( N, 2, v );
 }
 
+/* wall clock seconds spent in each phase of the steps */
+static double phase_times[NR_PHASES];
+
+static const char * phase_names[] = {
+	[PHASE_ADD_SOURCE] = "add_source",
+	[PHASE_DIFFUSE] = "diffuse",
+	[PHASE_ADVECT] = "advect",
+	[PHASE_PROJECT] = "project",
+};
+
+#define TIMED(phase, call) { double t0 = omp_get_wtime ( ); call; phase_times[phase] += omp_get_wtime ( ) - t0; }
+
+const char * phase_name ( int phase )
+{
+	if ( phase<0 || phase>=NR_PHASES ) return ( "unknown" );
+	return ( phase_names[phase] );
+}
+
+void phase_stats ( double times[NR_PHASES] )
+{
+	memcpy ( times, phase_times, sizeof(phase_times) );
+	memset ( phase_times, 0, sizeof(phase_times) );
+}
+
 void dens_step ( int N, float * x, float * x0, float * u, float * v, float diff, float dt )
 {
-	add_source ( N, x, x0, dt );
-	SWAP ( x0, x ); diffuse ( N, 0, x, x0, diff, dt );
-	SWAP ( x0, x ); advect ( N, 0, x, x0, u, v, dt );
+	TIMED ( PHASE_ADD_SOURCE, add_source ( N, x, x0, dt ) );
+	SWAP ( x0, x ); TIMED ( PHASE_DIFFUSE, diffuse ( N, 0, x, x0, diff, dt ) );
+	SWAP ( x0, x ); TIMED ( PHASE_ADVECT, advect ( N, 0, x, x0, u, v, dt ) );
 }
 
 void vel_step ( int N, float * u, float * v, float * u0, float * v0, float visc, float dt )
 {
-	add_source ( N, u, u0, dt ); add_source ( N, v, v0, dt );
-	SWAP ( u0, u ); diffuse ( N, 1, u, u0, visc, dt );
-	SWAP ( v0, v ); diffuse ( N, 2, v, v0, visc, dt );
-	project ( N, u, v, u0, v0 );
+	TIMED ( PHASE_ADD_SOURCE, add_source ( N, u, u0, dt ); add_source ( N, v, v0, dt ) );
+	SWAP ( u0, u ); TIMED ( PHASE_DIFFUSE, diffuse ( N, 1, u, u0, visc, dt ) );
+	SWAP ( v0, v ); TIMED ( PHASE_DIFFUSE, diffuse ( N, 2, v, v0, visc, dt ) );
+	TIMED ( PHASE_PROJECT, project ( N, u, v, u0, v0 ) );
 	SWAP ( u0, u ); SWAP ( v0, v );
-	advect ( N, 1, u, u0, u0, v0, dt ); advect ( N, 2, v, v0, u0, v0, dt );
-	project ( N, u, v, u0, v0 );
+	{
+		int b[2] = { 1, 2 };
+		float * d[2] = { u, v }, * d0[2] = { u0, v0 };
+		TIMED ( PHASE_ADVECT, advect_fields ( N, 2, b, d, d0, u0, v0, dt ) );
+	}
+	TIMED ( PHASE_PROJECT, project ( N, u, v, u0, v0 ) );
+}
+
+/*
+ * vel_step() and dens_step() in one, with a single advection pass for
+ * the velocity, the density and nscalars extra passive scalars (s[k]
+ * with the sources s0[k], diffused like the density). The density is
+ * carried by the projected velocity of the start of the step, where
+ * dens_step() after vel_step() uses the velocity of its end.
+ */
+void fluid_step ( int N, float * u, float * v, float * u0, float * v0, float * dens, float * dens0,
+		int nscalars, float ** s, float ** s0, float visc, float diff, float dt )
+{
+	int b[ADVECT_MAX_FIELDS], n = 3+nscalars, k;
+	float * d[ADVECT_MAX_FIELDS], * d0[ADVECT_MAX_FIELDS];
+
+	if ( n>ADVECT_MAX_FIELDS ) {
+		vel_step ( N, u, v, u0, v0, visc, dt );
+		dens_step ( N, dens, dens0, u, v, diff, dt );
+		for ( k=0 ; k<nscalars ; k++ ) dens_step ( N, s[k], s0[k], u, v, diff, dt );
+		return;
+	}
+	b[0] = 1; d[0] = u; d0[0] = u0;
+	b[1] = 2; d[1] = v; d0[1] = v0;
+	b[2] = 0; d[2] = dens; d0[2] = dens0;
+	for ( k=0 ; k<nscalars ; k++ ) {
+		b[3+k] = 0; d[3+k] = s[k]; d0[3+k] = s0[k];
+	}
+
+	TIMED ( PHASE_ADD_SOURCE,
+		for ( k=0 ; k<n ; k++ ) add_source ( N, d[k], d0[k], dt ) );
+	TIMED ( PHASE_DIFFUSE,
+		for ( k=0 ; k<n ; k++ ) {
+			SWAP ( d0[k], d[k] ); diffuse ( N, b[k], d[k], d0[k], k<2 ? visc : diff, dt );
+		} );
+	TIMED ( PHASE_PROJECT, project ( N, d[0], d[1], d0[0], d0[1] ) );
+	for ( k=0 ; k<n ; k++ ) SWAP ( d0[k], d[k] );
+	TIMED ( PHASE_ADVECT, advect_fields ( N, n, b, d, d0, d0[0], d0[1], dt ) );
+	TIMED ( PHASE_PROJECT, project ( N, d[0], d[1], d0[0], d0[1] ) );
 }
 
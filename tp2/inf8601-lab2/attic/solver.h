@@ -11,4 +11,59 @@
 void dens_step ( int N, float * x, float * x0, float * u, float * v, float diff, float dt );
 void vel_step ( int N, float * u, float * v, float * u0, float * v0, float visc, float dt );
 
+/*
+ * vel_step() then dens_step() with a single advection pass for u, v, the
+ * density and nscalars passive scalars s[k] (sources s0[k]); the density
+ * is carried by the velocity of the start of the step.
+ */
+void fluid_step ( int N, float * u, float * v, float * u0, float * v0, float * dens, float * dens0,
+		int nscalars, float ** s, float ** s0, float visc, float diff, float dt );
+
+/* compulsory memory traffic of advecting n fields, in one pass or one at a time */
+double advect_bytes ( int N, int n, int fused );
+
+/* solvers of the pressure equation in project() */
+enum pressure_solver {
+	PRESSURE_GS,		/* fixed number of red-black Gauss-Seidel sweeps, the reference */
+	PRESSURE_CG,		/* conjugate gradient, one V-cycle as preconditioner */
+	PRESSURE_MG,		/* multigrid V-cycles, the default */
+};
+
+struct pressure_stats {
+	int calls;			/* project() calls */
+	int iterations;		/* sweeps, CG iterations or V-cycles, summed over the calls */
+	float residual;		/* worst final residual, relative to the divergence */
+};
+
+/* -1 for an unknown name */
+int pressure_lookup ( const char * name );
+const char * pressure_name ( int solver );
+
+/*
+ * Select the solver, stop when the residual is under tol times the
+ * divergence or after max_iter iterations (0 for the default of the
+ * solver). Returns -1 on invalid arguments.
+ */
+int pressure_config ( int solver, float tol, int max_iter );
+
+/* Statistics since the previous call. */
+void pressure_stats ( struct pressure_stats * st );
+
+/* rms of the divergence of (u, v), in cell units */
+float divergence ( int N, float * u, float * v );
+
+/* phases of dens_step() and vel_step(), timed separately */
+enum solver_phase {
+	PHASE_ADD_SOURCE,
+	PHASE_DIFFUSE,
+	PHASE_ADVECT,
+	PHASE_PROJECT,
+	NR_PHASES
+};
+
+const char * phase_name ( int phase );
+
+/* Seconds spent in each phase since the previous call. */
+void phase_stats ( double times[NR_PHASES] );
+
 #endif /* SOLVER_H_ */
@@ -8,11 +8,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
 #include <math.h>
 
 #include "stripe.h"
-#include "list.h"
-#include "util.h"
+#include "memory.h"
 
 stripe_t *make_stripe(int width, int height)
 {
@@ -323,6 +323,42 @@ void stripe_set_bounds(stripe_t *stripe)
 	s.data[IX(w-1,h-1,w)] = s.data[IX(w-2,h-2,w)];
 }
 
+/* left and right padding columns only, the rows belong to the neighbours */
+void stripe_set_side_bounds(stripe_t *stripe)
+{
+	int j, w;
+	if (stripe == NULL)
+		return;
+	stripe_t s = *stripe;
+	w = s.width;
+	for (j=0; j < s.height; j++) {
+		s.data[IX(0,j,w)] = s.data[IX(1,j,w)];
+		s.data[IX(w-1,j,w)] = s.data[IX(w-2,j,w)];
+	}
+}
+
+/*
+ * fill the top padding of s with the last inner line of top and its bottom
+ * padding with the first inner line of bot. A NULL neighbour is the edge
+ * of the domain, the padding then mirrors the inner line of s.
+ */
+void stripe_pull_bounds(stripe_t *s, stripe_t *top, stripe_t *bot)
+{
+	int w, h;
+	if (s == NULL)
+		return;
+	w = s->width;
+	h = s->height;
+	if (top != NULL && top->width == w)
+		memcpy(&s->data[IX(0,0,w)], &top->data[IX(0,top->height-2,w)], w * sizeof(float));
+	else
+		memcpy(&s->data[IX(0,0,w)], &s->data[IX(0,1,w)], w * sizeof(float));
+	if (bot != NULL && bot->width == w)
+		memcpy(&s->data[IX(0,h-1,w)], &bot->data[IX(0,1,w)], w * sizeof(float));
+	else
+		memcpy(&s->data[IX(0,h-1,w)], &s->data[IX(0,h-2,w)], w * sizeof(float));
+}
+
 void dump_stripe(stripe_t *stripe)
 {
 	int x, y;
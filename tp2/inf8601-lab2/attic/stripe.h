@@ -41,6 +41,8 @@ void stripe_mul(stripe_t *stripe, float factor);
 void stripe_array_trimmed_size(stripe_array_t *array, int *w, int *h);
 float stripe_diff(stripe_t *s1, stripe_t *s2);
 void stripe_xchg_bounds(stripe_t *s1, stripe_t *s2);
+void stripe_set_side_bounds(stripe_t *stripe);
+void stripe_pull_bounds(stripe_t *s, stripe_t *top, stripe_t *bot);
 void foreach_stripe_0(stripe_array_t *s, void(*func)(stripe_t *));
 void foreach_stripe_1(stripe_array_t *s, void(*func)(stripe_t *, float), float f);
 float stripe_sum_inner(stripe_t *a);
@@ -15,6 +15,18 @@
 #include "chunk.h"
 #include "omp.h"
 
+/* _mm_cvtsi128_si64 and SSE2 as a baseline are x86-64 only */
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * Bytes per block of encode_simd(): the blocks are shared among the
+ * threads, and a block is read, encoded and summed while it is in L1.
+ */
+#define ENCODE_BLOCK (16 * 1024)
+
 int sigma(int n)
 {
     return (n + 1) * n;
@@ -27,12 +39,13 @@ struct cs {
 int encode_fast(struct chunk *chunk)
 {
     // TODO
-    int i;
+    int64_t i;
+    int64_t area = chunk->area;
     uint64_t checksum = 0;
     char* data = chunk->data;
 
     #pragma omp parallel for private(i) reduction(+:checksum)
-    for (i = 0; i < chunk->area; i++) {
+    for (i = 0; i < area; i++) {
             data[i] = data[i] + chunk->key;
             checksum += data[i];
     }
@@ -42,15 +55,119 @@ int encode_fast(struct chunk *chunk)
     return 0;
 }
 
+static int64_t encode_block_scalar(char *data, size_t n, char key)
+{
+    size_t i;
+    int64_t sum = 0;
+
+    for (i = 0; i < n; i++) {
+        data[i] = data[i] + key;
+        sum += data[i];
+    }
+    return sum;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Sum of n signed bytes without a widening per byte: flipping the sign
+ * bit maps a signed byte b to the unsigned b + 128, so the sum is the
+ * unsigned sum of the flipped bytes minus 128 n, and the unsigned sums of
+ * 8 bytes are what psadbw computes against zero.
+ */
+__attribute__((target("avx2")))
+static int64_t encode_block_avx2(char *data, size_t n, char key)
+{
+    size_t i;
+    __m256i k = _mm256_set1_epi8(key);
+    __m256i bias = _mm256_set1_epi8((char) 0x80);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    __m256i v;
+    __m128i s;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        v = _mm256_loadu_si256((__m256i *) &data[i]);
+        v = _mm256_add_epi8(v, k);
+        _mm256_storeu_si256((__m256i *) &data[i], v);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_xor_si256(v, bias), zero));
+    }
+    s = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    return (int64_t) _mm_cvtsi128_si64(s) - 128 * (int64_t) i +
+            encode_block_scalar(data + i, n - i, key);
+}
+
+/* SSE2 is part of x86-64, the fallback when AVX2 is missing */
+static int64_t encode_block_sse2(char *data, size_t n, char key)
+{
+    size_t i;
+    __m128i k = _mm_set1_epi8(key);
+    __m128i bias = _mm_set1_epi8((char) 0x80);
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    __m128i v;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm_loadu_si128((__m128i *) &data[i]);
+        v = _mm_add_epi8(v, k);
+        _mm_storeu_si128((__m128i *) &data[i], v);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(v, bias), zero));
+    }
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return (int64_t) _mm_cvtsi128_si64(acc) - 128 * (int64_t) i +
+            encode_block_scalar(data + i, n - i, key);
+}
+#endif
+
+typedef int64_t (*encode_block_fct)(char *, size_t, char);
+
+static encode_block_fct encode_block_select(void)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return encode_block_avx2;
+    return encode_block_sse2;
+#else
+    return encode_block_scalar;
+#endif
+}
+
+/*
+ * Vector encoder: the chunk is cut in ENCODE_BLOCK blocks distributed
+ * statically among the threads, so each thread streams one contiguous
+ * range, and every block is encoded and summed in a single pass.
+ */
+int encode_simd(struct chunk *chunk)
+{
+    int64_t b;
+    size_t area = chunk->area;
+    int64_t nblocks = (area + ENCODE_BLOCK - 1) / ENCODE_BLOCK;
+    char *data = chunk->data;
+    char key = chunk->key;
+    int64_t checksum = 0;
+    encode_block_fct encode_block = encode_block_select();
+
+    #pragma omp parallel for schedule(static) reduction(+:checksum)
+    for (b = 0; b < nblocks; b++) {
+        size_t start = (size_t) b * ENCODE_BLOCK;
+        size_t n = area - start < ENCODE_BLOCK ? area - start : ENCODE_BLOCK;
+        checksum += encode_block(data + start, n, key);
+    }
+    chunk->checksum = checksum;
+    return 0;
+}
+
 int encode_slow_a(struct chunk *chunk)
 {
-    int i, j;
+    int64_t i, j;
+    int64_t width = chunk->width;
+    int64_t height = chunk->height;
     uint64_t checksum = 0;
 
     #pragma omp parallel for private(i,j) reduction(+:checksum)
-    for (i = 0; i < chunk->height; i++) {
-        for (j = 0; j < chunk->width; j++) {
-            int index = i * chunk->width + j;
+    for (i = 0; i < height; i++) {
+        for (j = 0; j < width; j++) {
+            int64_t index = i * width + j;
             chunk->data[index] = chunk->data[index] + chunk->key;
             checksum += chunk->data[index];
         }
@@ -61,8 +178,8 @@ int encode_slow_a(struct chunk *chunk)
 
 int encode_slow_b(struct chunk *chunk)
 {
-    int i;
-    int area = chunk->area;
+    int64_t i;
+    int64_t area = chunk->area;
     int key = chunk->key;
     char *data = chunk->data;
     uint64_t* checksums;
@@ -91,10 +208,10 @@ int encode_slow_b(struct chunk *chunk)
 
 int encode_slow_c(struct chunk *chunk)
 {
-    int i;
-    int checksum = 0;
+    int64_t i;
+    int64_t checksum = 0;
     char *data = chunk->data;
-    int area = chunk->area;
+    int64_t area = chunk->area;
     int key = chunk->key;
 
     #pragma omp parallel for
@@ -109,10 +226,10 @@ int encode_slow_c(struct chunk *chunk)
 
 int encode_slow_d(struct chunk *chunk)
 {
-    int i;
-    int checksum = 0;
+    int64_t i;
+    int64_t checksum = 0;
     char *data = chunk->data;
-    int area = chunk->area;
+    int64_t area = chunk->area;
     int key = chunk->key;
 
     #pragma omp parallel for
@@ -131,17 +248,17 @@ int encode_slow_d(struct chunk *chunk)
 int encode_slow_e(struct chunk *chunk)
 {
 
-    int i, j;
-    int checksum = 0;
-    int width = chunk->width;
-    int height = chunk->height;
+    int64_t i, j;
+    int64_t checksum = 0;
+    int64_t width = chunk->width;
+    int64_t height = chunk->height;
     int key = chunk->key;
     char *data = chunk->data;
 
     #pragma omp parallel for private(i,j) reduction(+:checksum)
     for (i = 0; i < width; i++) {
         for (j = 0; j < height; j++) {
-            int index = i + j * width;
+            int64_t index = i + j * width;
             data[index] = data[index] + key;
             checksum += data[index];
         }
@@ -152,8 +269,8 @@ int encode_slow_e(struct chunk *chunk)
 
 int encode_slow_f(struct chunk *chunk)
 {
-    int i;
-    int area = chunk->area;
+    int64_t i;
+    int64_t area = chunk->area;
     int key = chunk->key;
     char *data = chunk->data;
     struct cs* cs;
@@ -172,8 +289,8 @@ int encode_slow_f(struct chunk *chunk)
         #pragma omp barrier
         checksum = 0;
         int id = omp_get_thread_num();
-        int start = (int) (((uint64_t)sigma(id)) * area / sig);
-        int end   = (int) (((uint64_t)sigma(id + 1)) * area / sig);
+        int64_t start = (int64_t) (((uint64_t)sigma(id)) * area / sig);
+        int64_t end   = (int64_t) (((uint64_t)sigma(id + 1)) * area / sig);
 
         for (i = start; i < end; i++) {
             data[i] = data[i] + key;
@@ -18,6 +18,7 @@ struct encoder_def {
 };
 
 int encode_fast(struct chunk *chunk);
+int encode_simd(struct chunk *chunk);
 int encode_slow_a(struct chunk *chunk);
 int encode_slow_b(struct chunk *chunk);
 int encode_slow_c(struct chunk *chunk);
@@ -0,0 +1,88 @@
+/*
+ * bandwidth.c
+ *
+ * Same kernels and byte accounting as STREAM (McCalpin): copy moves 16
+ * bytes per element, triad 24. Both also pay a write allocate on their
+ * destination, which an in-place pass does not, so the encoders are
+ * compared with update, an in-place scale counted 16 bytes per element.
+ * The arrays are first touched with the static schedule of the kernels,
+ * like the chunk of the encoders.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "bandwidth.h"
+#include "omp.h"
+
+#define BANDWIDTH_ELEMENTS (16L << 20)  /* 128 MiB per array */
+#define BANDWIDTH_PASSES 5
+
+static double now(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+int bandwidth_measure(struct bandwidth *bw)
+{
+    double *a, *b, *c;
+    double t, best_copy = 0, best_triad = 0, best_update = 0;
+    const double s = 3.0;
+    int64_t i, n = BANDWIDTH_ELEMENTS;
+    int pass;
+
+    a = malloc(n * sizeof(double));
+    b = malloc(n * sizeof(double));
+    c = malloc(n * sizeof(double));
+    if (a == NULL || b == NULL || c == NULL) {
+        free(a);
+        free(b);
+        free(c);
+        return -1;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+
+    for (pass = 0; pass < BANDWIDTH_PASSES; pass++) {
+        t = now();
+        #pragma omp parallel for schedule(static)
+        for (i = 0; i < n; i++)
+            c[i] = a[i];
+        t = now() - t;
+        if (best_copy == 0 || t < best_copy)
+            best_copy = t;
+
+        t = now();
+        #pragma omp parallel for schedule(static)
+        for (i = 0; i < n; i++)
+            a[i] = b[i] + s * c[i];
+        t = now() - t;
+        if (best_triad == 0 || t < best_triad)
+            best_triad = t;
+
+        t = now();
+        #pragma omp parallel for schedule(static)
+        for (i = 0; i < n; i++)
+            b[i] = s * b[i];
+        t = now() - t;
+        if (best_update == 0 || t < best_update)
+            best_update = t;
+    }
+
+    bw->copy = 2 * sizeof(double) * n / best_copy / 1e9;
+    bw->triad = 3 * sizeof(double) * n / best_triad / 1e9;
+    bw->update = 2 * sizeof(double) * n / best_update / 1e9;
+    free(a);
+    free(b);
+    free(c);
+    return 0;
+}
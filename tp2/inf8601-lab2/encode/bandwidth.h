@@ -0,0 +1,22 @@
+/*
+ * bandwidth.h
+ *
+ * STREAM-like measure of the memory bandwidth the encoders can reach
+ */
+
+#ifndef BANDWIDTH_H_
+#define BANDWIDTH_H_
+
+struct bandwidth {
+    double copy;            /* GB/s, a[i] = b[i] */
+    double triad;           /* GB/s, a[i] = b[i] + s * c[i] */
+    double update;          /* GB/s, a[i] = s * a[i], in place like the encoders */
+};
+
+/*
+ * Best of a few passes over arrays well beyond the last level cache, with
+ * the current OpenMP team. Returns 0 on success.
+ */
+int bandwidth_measure(struct bandwidth *bw);
+
+#endif /* BANDWIDTH_H_ */
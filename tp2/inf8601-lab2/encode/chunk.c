@@ -9,12 +9,101 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include "chunk.h"
 #include "omp.h"
 
-struct chunk *make_chunk(int width, int height)
+#define HUGEPAGE_SIZE (2UL << 20)
+#define FILL_BLOCK 65536            /* bytes per random stream */
+#define MPOL_INTERLEAVE 3           /* from linux/mempolicy.h */
+#define MAX_NODES 1024
+
+struct chunk *make_chunk(size_t width, size_t height)
+{
+    return make_chunk_flags(width, height, 0);
+}
+
+/* bitmask of the online NUMA nodes, 0 if there is no NUMA support */
+static int online_nodes(unsigned long *mask, int maxnode)
+{
+    FILE *f;
+    int a, b, n = 0;
+    char sep;
+
+    memset(mask, 0, maxnode / 8);
+    f = fopen("/sys/devices/system/node/online", "r");
+    if (f == NULL)
+        return 0;
+    while (fscanf(f, "%d", &a) == 1) {
+        b = a;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(f, "%d", &b) != 1)
+                break;
+            if (fscanf(f, "%c", &sep) != 1)
+                sep = '\n';
+        }
+        for (; a <= b && a < maxnode; a++, n++)
+            mask[a / (8 * sizeof(long))] |= 1UL << (a % (8 * sizeof(long)));
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return n;
+}
+
+/*
+ * mmap'ed data: MAP_HUGETLB when hugetlbfs pages are reserved, otherwise
+ * plain pages with MADV_HUGEPAGE. The placement is set before any page
+ * is touched, interleave through mbind(2), first touch by zeroing with
+ * the static schedule of the encoders. *obtained gets the flags that took
+ * effect, CHUNK_THP instead of CHUNK_HUGEPAGES for the fallback.
+ */
+static char *map_data(size_t len, int flags, size_t *mapped, int *obtained)
+{
+    unsigned long nodes[MAX_NODES / (8 * sizeof(long))];
+    char *data = MAP_FAILED;
+    int64_t i;
+
+    *obtained = 0;
+    if (flags & CHUNK_HUGEPAGES) {
+        *mapped = (len + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+        data = mmap(NULL, *mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+            *obtained |= CHUNK_HUGEPAGES;
+    }
+    if (data == MAP_FAILED) {
+        *mapped = len;
+        data = mmap(NULL, *mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return NULL;
+        if ((flags & CHUNK_HUGEPAGES) && madvise(data, *mapped, MADV_HUGEPAGE) == 0)
+            *obtained |= CHUNK_THP;
+    }
+
+    if ((flags & CHUNK_INTERLEAVE) && online_nodes(nodes, MAX_NODES) > 1) {
+        if (syscall(SYS_mbind, data, *mapped, MPOL_INTERLEAVE, nodes, MAX_NODES, 0) == 0)
+            *obtained |= CHUNK_INTERLEAVE;
+        else
+            perror("mbind interleave failed");
+    }
+
+    if (flags & CHUNK_FIRST_TOUCH) {
+        *obtained |= CHUNK_FIRST_TOUCH;
+        #pragma omp parallel for schedule(static)
+        for (i = 0; i < (int64_t) len; i++)
+            data[i] = 0;
+    }
+    return data;
+}
+
+struct chunk *make_chunk_flags(size_t width, size_t height, int flags)
 {
     char *data;
     struct chunk *m = calloc(1, sizeof(struct chunk));
@@ -23,7 +112,14 @@ struct chunk *make_chunk(int width, int height)
     m->width = width;
     m->height = height;
     m->area = width * height;
-    data = malloc(m->area * sizeof(char));
+    if (height != 0 && m->area / height != width) {
+        free(m);
+        return NULL;
+    }
+    if (flags == 0)
+        data = malloc(m->area * sizeof(char));
+    else
+        data = map_data(m->area * sizeof(char), flags, &m->mapped, &m->flags);
     if (data == NULL) {
         free(m);
         return NULL;
@@ -36,6 +132,10 @@ void free_chunk(struct chunk *m)
 {
     if(m == NULL)
         return;
+    if (m->data != NULL && m->mapped > 0) {
+        munmap(m->data, m->mapped);
+        m->data = NULL;
+    }
     if (m->data != NULL) {
         free(m->data);
         m->data = NULL;
@@ -45,22 +145,75 @@ void free_chunk(struct chunk *m)
     return;
 }
 
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t xoshiro256ss(uint64_t s[4])
+{
+    uint64_t res = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return res;
+}
+
+/*
+ * Every FILL_BLOCK gets its own xoshiro256** stream seeded from (seed,
+ * block), so the content does not depend on the number of threads. The
+ * static schedule over the blocks follows the one of the encoders, which
+ * makes the fill the first touch of the pages that were not touched yet.
+ */
 void randomize_chunk(struct chunk *chunk)
 {
-    int i;
-    struct chunk c = *chunk;
-    c.checksum = 0;
-    srand(time(NULL));
-    for (i = 0; i < c.area; i++) {
-        c.data[i] = rand();
-        c.checksum += c.data[i];
+    int64_t b;
+    int64_t nblocks = (chunk->area + FILL_BLOCK - 1) / FILL_BLOCK;
+    uint64_t seed = time(NULL);
+    uint64_t checksum = 0;
+    char *data = chunk->data;
+    size_t area = chunk->area;
+
+    #pragma omp parallel for schedule(static) reduction(+:checksum)
+    for (b = 0; b < nblocks; b++) {
+        uint64_t s[4], x = seed ^ ((uint64_t) b << 32);
+        uint64_t r;
+        size_t i = (size_t) b * FILL_BLOCK;
+        size_t end = i + FILL_BLOCK < area ? i + FILL_BLOCK : area;
+        int k;
+
+        for (k = 0; k < 4; k++)
+            s[k] = splitmix64(&x);
+        for (; i + 8 <= end; i += 8) {
+            r = xoshiro256ss(s);
+            memcpy(&data[i], &r, 8);
+            for (k = 0; k < 8; k++)
+                checksum += data[i + k];
+        }
+        r = xoshiro256ss(s);
+        for (k = 0; i < end; i++, k++) {
+            data[i] = r >> (8 * k);
+            checksum += data[i];
+        }
     }
-    *chunk = c;
+    chunk->checksum = checksum;
 }
 
 void linear_chunk(struct chunk *chunk)
 {
-    int i;
+    size_t i;
     struct chunk c = *chunk;
     c.checksum = 0;
     for (i = 0; i<c.area; i++) {
@@ -72,7 +225,7 @@ void linear_chunk(struct chunk *chunk)
 
 void dump_chunk(struct chunk *chunk)
 {
-    int i, j;
+    size_t i, j;
     struct chunk c = *chunk;
     for (i = 0; i<c.height; i++) {
         for (j = 0; j<c.width; j++) {
@@ -85,5 +238,5 @@ void dump_chunk(struct chunk *chunk)
 
 size_t chunk_size(struct chunk *chunk)
 {
-    return sizeof(uint64_t) * chunk->area;
+    return sizeof(char) * chunk->area;
 }
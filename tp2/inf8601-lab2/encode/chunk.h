@@ -9,17 +9,27 @@
 #define CHUNK_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+/* make_chunk_flags() placement of the data */
+#define CHUNK_HUGEPAGES     0x1     /* hugetlbfs pages, else transparent huge pages */
+#define CHUNK_FIRST_TOUCH   0x2     /* each page zeroed by the thread encoding it */
+#define CHUNK_INTERLEAVE    0x4     /* pages spread round robin over the NUMA nodes */
+#define CHUNK_THP           0x8     /* in chunk->flags only: transparent huge pages */
 
 struct chunk {
     char *data;
-    int width;
-    int height;
-    int area;
+    size_t width;
+    size_t height;
+    size_t area;
     char key;
     uint64_t checksum;
+    size_t mapped;          /* length of the mmap of data, 0 if malloc'ed */
+    int flags;              /* placement actually obtained, may lack requested flags */
 };
 
-struct chunk *make_chunk(int width, int height);
+struct chunk *make_chunk(size_t width, size_t height);
+struct chunk *make_chunk_flags(size_t width, size_t height, int flags);
 void free_chunk(struct chunk *m);
 void randomize_chunk(struct chunk *chunk);
 void linear_chunk(struct chunk *chunk);
@@ -19,10 +19,16 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 
 #include "chunk.h"
 #include "algo.h"
+#include "pmu.h"
+#include "bandwidth.h"
+#include "topology.h"
 #include "omp.h"
 #include "config.h"
 
@@ -34,9 +40,16 @@
 #define DEFAULT_NB_THREAD 2
 #define DEFAULT_HYPERTHREAD  1
 #define DEFAULT_FUNC "fast"
+#define DEFAULT_FILE_FUNC "simd"
+#define DEFAULT_KEY 13
+#define FILE_SUFFIX ".enc"
+#define FILE_BATCH 64           /* windows per batch written to a pipe */
 #define DEFAULT_CMD "check"
 #define ONE_MB 1048576
 #define MICROSECONDS_PER_SECOND 1000000
+#define ENCODE_TRAFFIC 2            /* bytes moved per byte encoded, read and write */
+#define BANDWIDTH_BOUND 0.6         /* fraction of the in-place peak deemed memory bound */
+#define SCALING_FLOOR 0.5           /* parallel efficiency below which it falls off */
 int verbose = 0;
 
 static const struct command_def * const commands[];
@@ -53,19 +66,28 @@ struct command_opts {
     const struct command_def *cmd;
     const struct encoder_def *enc;
     int nb_thread;
-    int height;
-    int width;
+    size_t height;
+    size_t width;
     int verbose;
     int repeat;
     int max;
     int hyperthread;
+    int placement;              /* -1: from hyperthread */
+    int numa;                   /* CHUNK_FIRST_TOUCH, CHUNK_INTERLEAVE or 0 */
+    int hugepages;
+    struct topology *topo;
     char *output;
+    char *input;
+    int key;
+    int decode;
+    int verify;
 };
 
 struct stats {
     struct timeval elapsed;
     struct timeval user;
     struct timeval system;
+    double bytes;               /* encoded and decoded */
 };
 
 __attribute__((noreturn))
@@ -75,21 +97,32 @@ static void usage(void)
     fprintf(stderr, "Usage: " PROGNAME " [OPTIONS] [COMMAND]\n");
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr, "  --help               this help\n");
-    fprintf(stderr, "  --cmd                command [ check | benchmark ]\n");
+    fprintf(stderr, "  --cmd                command [ check | benchmark | file ]\n");
     fprintf(stderr, "  --thread             set number of threads\n");
     fprintf(stderr, "  --max                set max number of threads for benchmark\n");
     fprintf(stderr, "  --height             set buffer height\n");
     fprintf(stderr, "  --width              set buffer width\n");
     fprintf(stderr, "  --repeat             set number of roundtrip processing\n");
     fprintf(stderr, "  --hyperthread        set hyperthreading (0 disable, 1 force, default 1)\n");
+    fprintf(stderr, "  --placement          pin threads [ none | compact | scatter | core | socket ]\n");
+    fprintf(stderr, "                       (default: compact with hyperthread, core without)\n");
     fprintf(stderr, "  --func               only execute this function\n");
-    fprintf(stderr, "  --output             set output file (default: %s)\n", DEFAULT_OUTPUT);
+    fprintf(stderr, "  --numa               benchmark chunk placement [ none | touch | interleave ]\n");
+    fprintf(stderr, "  --hugepages          back the benchmark chunk with huge pages\n");
+    fprintf(stderr, "  --output             set output file (default: %s, file: <input>%s, - for stdout)\n",
+            DEFAULT_OUTPUT, FILE_SUFFIX);
+    fprintf(stderr, "  --input              set file to encode (file)\n");
+    fprintf(stderr, "  --key                set encoding key (file, default %d)\n", DEFAULT_KEY);
+    fprintf(stderr, "  --decode             decode instead of encode (file)\n");
+    fprintf(stderr, "  --verify             check that every window decodes back (file)\n");
+    fprintf(stderr, "  --width, --height    also set the window of the file command\n");
     fprintf(stderr, "\n");
     exit(EXIT_FAILURE);
 }
 
 static const struct encoder_def encoders[] = {
         { .name = "fast", .encode_handler = encode_fast },
+        { .name = "simd", .encode_handler = encode_simd },
         { .name = "slow_a", .encode_handler = encode_slow_a },
         { .name = "slow_b", .encode_handler = encode_slow_b },
         { .name = "slow_c", .encode_handler = encode_slow_c },
@@ -99,28 +132,46 @@ static const struct encoder_def encoders[] = {
         { .name = NULL, .encode_handler = NULL }
 };
 
+static const struct encoder_def *lookup_func(const char *name)
+{
+    int i;
+    for (i = 0; encoders[i].name != NULL; i++) {
+        if (strcmp(encoders[i].name, name) == 0)
+            return &encoders[i];
+    }
+    return NULL;
+}
+
 int gettid() {
     return (int) syscall(SYS_gettid);
 }
 
+/*
+ * Hyperthreading on packs the threads on the SMT siblings of the first
+ * cores, off gives every thread a core of its own.
+ */
+static int placement(struct command_opts *opts)
+{
+    if (opts->placement >= 0)
+        return opts->placement;
+    return opts->hyperthread ? TOPO_COMPACT : TOPO_CORE;
+}
+
 int init_openmp(struct command_opts *opts) {
     omp_set_num_threads(opts->nb_thread);
     int error = 0;
+    int policy = placement(opts);
     #pragma omp parallel reduction(+:error)
     {
         cpu_set_t cpuset;
-        int cpus = sysconf(_SC_NPROCESSORS_ONLN);
         int id = omp_get_thread_num();
-        int core = id % cpus;
-        if (opts->hyperthread)
-            core = (id * 4) % cpus;
-        CPU_ZERO(&cpuset);
-        CPU_SET(core, &cpuset);
-        sched_setaffinity(gettid(), sizeof(cpuset), &cpuset);
+        if (topology_cpuset(opts->topo, policy, id, &cpuset)) {
+            sched_setaffinity(gettid(), sizeof(cpuset), &cpuset);
+            if (!CPU_ISSET(sched_getcpu(), &cpuset))
+                error++;
+        }
         if (opts->verbose)
-            printf("pin %d %d %d\n", gettid(), id, core);
-        if (core != sched_getcpu())
-            error++;
+            printf("pin %d %d %s %d\n", gettid(), id, topology_name(policy), sched_getcpu());
     }
     return !!error;
 }
@@ -196,24 +247,75 @@ struct timeval time_sub(struct timeval t1, struct timeval t2)
     return res;
 }
 
-void write_stats_header(FILE *f, struct command_opts *opts, struct chunk *chunk)
+static const char *numa_name(int numa)
+{
+    if (numa & CHUNK_FIRST_TOUCH)
+        return "touch";
+    if (numa & CHUNK_INTERLEAVE)
+        return "interleave";
+    return "none";
+}
+
+static const char *hugepages_name(int flags)
+{
+    if (flags & CHUNK_HUGEPAGES)
+        return "hugetlb";
+    if (flags & CHUNK_THP)
+        return "thp";
+    return "none";
+}
+
+void write_stats_header(FILE *f, struct command_opts *opts, struct chunk *chunk,
+        struct pmu_set *pmu, struct bandwidth *peak)
 {
+    int ev;
+
     if (opts == NULL || f == NULL)
         return;
     double size = ((double)chunk_size(chunk) * opts->repeat * 2) / ONE_MB;
-    fprintf(f, "EXPERIMENT thread=%d width=%d height=%d repeat=%d hyperthread=%d size(Mib)=%.3f\n",
-            opts->nb_thread, opts->width, opts->height, opts->repeat, opts->hyperthread, size);
-    fprintf(f, "%s\n", "func,u,s,e");
+    /* what the chunk got, a failed request is not reported as granted */
+    fprintf(f, "EXPERIMENT thread=%d width=%zu height=%zu repeat=%d hyperthread=%d placement=%s "
+            "numa=%s hugepages=%s size(MiB)=%.3f copy(GB/s)=%.2f triad(GB/s)=%.2f update(GB/s)=%.2f\n",
+            opts->nb_thread, opts->width, opts->height, opts->repeat, opts->hyperthread,
+            topology_name(placement(opts)), numa_name(chunk->flags), hugepages_name(chunk->flags), size,
+            peak->copy, peak->triad, peak->update);
+    fprintf(f, "%s", "thread,func,u,s,e,mib_s,gb_s,peak,efficiency");
+    for (ev = 0; pmu != NULL && ev < PMU_NR_EVENTS; ev++)
+        if (pmu_has_event(pmu, ev))
+            fprintf(f, ",%s", pmu_event_name(ev));
+    fprintf(f, "\n");
+}
+
+/* counts summed over the threads, one column per counted event */
+void write_pmu_stats(FILE *f, struct pmu_set *pmu, struct pmu_counts *counts)
+{
+    uint64_t total;
+    int ev, t;
+
+    if (pmu == NULL)
+        return;
+    for (ev = 0; ev < PMU_NR_EVENTS; ev++) {
+        if (!pmu_has_event(pmu, ev))
+            continue;
+        total = 0;
+        for (t = 0; t < pmu_threads(pmu); t++)
+            total += counts[t].count[ev];
+        fprintf(f, "%"PRIu64",", total);
+    }
 }
 
 void write_stats(FILE *f, struct stats *s)
 {
+    double elapsed;
+
     if (s == NULL)
         return;
-    fprintf(f, "%ld.%06ld,%ld.%06ld,%ld.%06ld,",
+    elapsed = s->elapsed.tv_sec + s->elapsed.tv_usec / (double) MICROSECONDS_PER_SECOND;
+    fprintf(f, "%ld.%06ld,%ld.%06ld,%ld.%06ld,%.1f,",
             s->user.tv_sec, s->user.tv_usec,
             s->system.tv_sec, s->system.tv_usec,
-            s->elapsed.tv_sec, s->elapsed.tv_usec);
+            s->elapsed.tv_sec, s->elapsed.tv_usec,
+            elapsed > 0 ? s->bytes / ONE_MB / elapsed : 0);
 }
 
 int run_benchmark(struct stats *s, struct chunk *chunk, encode_fct encoder, int iter)
@@ -243,6 +345,7 @@ int run_benchmark(struct stats *s, struct chunk *chunk, encode_fct encoder, int
         s->user    = time_sub(r2.ru_utime, r1.ru_utime);
         s->system  = time_sub(r2.ru_stime, r1.ru_stime);
         s->elapsed = time_sub(t2, t1);
+        s->bytes   = (double) chunk_size(chunk) * iter * 2;
     }
 
 done:
@@ -258,23 +361,104 @@ static int cmd_check(struct command_opts *opts)
     return 0;
 }
 
+/*
+ * Memory traffic of the run in GB/s into *gbs, written with its fraction
+ * of the in-place peak and the parallel efficiency against base, the GB/s
+ * per thread of the first thread count (0 for the first one).
+ */
 static int do_benchmark(struct chunk *chunk, const struct encoder_def *enc,
-        int thread, int repeat, FILE *out)
+        int thread, int repeat, FILE *out, struct pmu_set *pmu, struct pmu_counts *counts,
+        const struct bandwidth *peak, double base, double *gbs)
 {
     struct stats stats;
+    double elapsed;
+    int t;
     fprintf(stderr, "processing %-6s %2d threads\n", enc->name, thread);
-    fprintf(out, "%s,", enc->name);
+    fprintf(out, "%d,%s,", thread, enc->name);
+    if (pmu != NULL)
+        pmu_start(pmu);
     int ret = run_benchmark(&stats, chunk, enc->encode_handler, repeat);
+    if (pmu != NULL) {
+        pmu_stop(pmu);
+        for (t = 0; t < pmu_threads(pmu); t++)
+            pmu_read(pmu, t, &counts[t]);
+    }
     if (ret < 0)
         return -1;
     write_stats(out, &stats);
+    elapsed = stats.elapsed.tv_sec + stats.elapsed.tv_usec / (double) MICROSECONDS_PER_SECOND;
+    *gbs = elapsed > 0 ? stats.bytes * ENCODE_TRAFFIC / elapsed / 1e9 : 0;
+    if (base == 0)
+        base = *gbs / thread;
+    fprintf(out, "%.3f,%.3f,%.3f,", *gbs, peak->update > 0 ? *gbs / peak->update : 0,
+            base > 0 ? *gbs / (base * thread) : 0);
+    write_pmu_stats(out, pmu, counts);
     fprintf(out, "\n");
     return 0;
 }
 
+/*
+ * Table of the GB/s of every encoder and thread count, then the verdict
+ * at the largest thread count: bound by bandwidth, or falling off with
+ * the threads (the counter report above tells why), or compute bound.
+ */
+static void write_roofline(FILE *out, const struct bandwidth *peak, const char **names,
+        int nenc, int first, int nt, const double *gbs)
+{
+    double frac, eff;
+    int i, t;
+
+    fprintf(out, "roofline: copy %.2f GB/s, triad %.2f GB/s, update %.2f GB/s\n",
+            peak->copy, peak->triad, peak->update);
+    fprintf(out, "%-8s", "func");
+    for (t = 0; t < nt; t++)
+        fprintf(out, " %9d thread(s)", first + t);
+    fprintf(out, "\n");
+    for (i = 0; i < nenc; i++) {
+        fprintf(out, "%-8s", names[i]);
+        for (t = 0; t < nt; t++) {
+            frac = peak->update > 0 ? gbs[t * nenc + i] / peak->update : 0;
+            eff = gbs[i] > 0 ? gbs[t * nenc + i] * first / (gbs[i] * (first + t)) : 0;
+            fprintf(out, " %6.2f %3.0f%% %5.2f", gbs[t * nenc + i], 100 * frac, eff);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "(GB/s, %% of update peak, parallel efficiency)\n");
+
+    t = nt - 1;
+    for (i = 0; i < nenc; i++) {
+        frac = peak->update > 0 ? gbs[t * nenc + i] / peak->update : 0;
+        eff = gbs[i] > 0 ? gbs[t * nenc + i] * first / (gbs[i] * (first + t)) : 0;
+        if (frac > 1.1)
+            fprintf(out, "%s: %.0f%% of peak, the chunk is served from cache\n",
+                    names[i], 100 * frac);
+        else if (frac >= BANDWIDTH_BOUND)
+            fprintf(out, "%s: memory bound, %.0f%% of peak\n", names[i], 100 * frac);
+        else if (nt > 1 && eff < SCALING_FLOOR)
+            fprintf(out, "%s: falls off, efficiency %.2f at %d threads\n",
+                    names[i], eff, first + t);
+        else
+            fprintf(out, "%s: compute bound, %.0f%% of peak\n", names[i], 100 * frac);
+    }
+}
+
+/*
+ * Every thread count runs on its own pinned team. The counters of every
+ * encoder are kept per thread for the report that closes each thread
+ * count, see pmu_report(), and the bandwidths for the roofline table.
+ */
 static int cmd_benchmark(struct command_opts *opts)
 {
     struct chunk *chunk = NULL;
+    struct pmu_set *pmu = NULL;
+    struct pmu_counts **counts = NULL;
+    const char **names = NULL;
+    struct command_opts run = *opts;
+    struct bandwidth peak = { 0, 0, 0 };
+    struct timeval t1, t2, dt;
+    double *gbs = NULL;
+    int nenc = 0, nrun;
+    int nt = opts->max - opts->nb_thread + 1;
     int i, t;
     int ret = 0;
 
@@ -285,26 +469,71 @@ static int cmd_benchmark(struct command_opts *opts)
     if (ret < 0)
         goto err;
 
-    chunk = make_chunk(opts->width, opts->height);
+    gettimeofday(&t1, NULL);
+    chunk = make_chunk_flags(opts->width, opts->height,
+            opts->numa | (opts->hugepages ? CHUNK_HUGEPAGES : 0));
     if (chunk == NULL)
         goto err;
 
     chunk->key = 13;
     randomize_chunk(chunk);
+    gettimeofday(&t2, NULL);
+    dt = time_sub(t2, t1);
+    fprintf(stderr, "chunk setup %ld.%06ld s\n", dt.tv_sec, dt.tv_usec);
+
+    run.nb_thread = opts->max;
+    init_openmp(&run);
+    if (bandwidth_measure(&peak) < 0)
+        fprintf(stderr, "warning: cannot measure the memory bandwidth\n");
+
+    for (i = 0; encoders[i].name != NULL; i++)
+        nenc++;
+    nrun = opts->enc == NULL ? nenc : 1;
+    counts = calloc(nenc, sizeof(struct pmu_counts *));
+    names = calloc(nenc, sizeof(char *));
+    /* one row of nrun encoders per thread count, as write_roofline reads it */
+    gbs = calloc(nt * nrun, sizeof(double));
+    if (counts == NULL || names == NULL || gbs == NULL)
+        goto err;
+    for (i = 0; i < nrun; i++)
+        names[i] = opts->enc == NULL ? encoders[i].name : opts->enc->name;
 
-    write_stats_header(f, opts, chunk);
+    pmu = pmu_open();
+    if (pmu == NULL)
+        fprintf(stderr, "warning: no performance counter available\n");
+    write_stats_header(f, opts, chunk, pmu, &peak);
     for(t = opts->nb_thread; t <= opts->max; t++) {
-        if (opts->enc == NULL) {
-            for (i = 0; encoders[i].name != NULL; i++) {
-                do_benchmark(chunk, &encoders[i], t, opts->repeat, f);
-            }
-        } else { /* perform only for one encoder */
-            do_benchmark(chunk, opts->enc, t, opts->repeat, f);
+        run.nb_thread = t;
+        init_openmp(&run);
+        /* the counters follow the threads of the team */
+        pmu_close(pmu);
+        pmu = pmu_open();
+        for (i = 0; i < nenc; i++) {
+            free(counts[i]);
+            counts[i] = pmu != NULL ? calloc(pmu_threads(pmu), sizeof(struct pmu_counts)) : NULL;
+            if (pmu != NULL && counts[i] == NULL)
+                goto err;
+        }
+        for (i = 0; i < nrun; i++) {
+            do_benchmark(chunk, opts->enc == NULL ? &encoders[i] : opts->enc, t, opts->repeat,
+                    f, pmu, counts[i], &peak, t == opts->nb_thread ? 0 : gbs[i] / opts->nb_thread,
+                    &gbs[(t - opts->nb_thread) * nrun + i]);
         }
         fprintf(f, "\n");
+        if (pmu != NULL)
+            pmu_report(stderr, pmu, names, counts, nrun,
+                    (double) chunk->area * opts->repeat * 2);
     }
+    write_roofline(stderr, &peak, names, nrun, opts->nb_thread, nt, gbs);
 
 done:
+    init_openmp(opts);
+    for (i = 0; counts != NULL && i < nenc; i++)
+        free(counts[i]);
+    free(counts);
+    free(names);
+    free(gbs);
+    pmu_close(pmu);
     free_chunk(chunk);
     if (f != NULL)
         fclose(f);
@@ -314,18 +543,241 @@ err:
     goto done;
 }
 
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write failed");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+struct file_sums {
+    uint64_t input;
+    uint64_t output;
+    long bad_windows;
+};
+
+/*
+ * Encode [0, len) of src into dst, window by window across the threads.
+ * The window is copied, summed with key 0 (the encoders leave the data
+ * unchanged and return its checksum), encoded, and with verify decoded
+ * again on a scratch copy. Everything but the copy runs on a window that
+ * is still in cache, so the cost stays one read of src and one write of
+ * dst.
+ */
+static void encode_windows(const char *src, char *dst, size_t len, size_t window,
+        const struct encoder_def *enc, char key, int verify, struct file_sums *sums)
+{
+    long w;
+    long nwin = (len + window - 1) / window;
+    uint64_t in_sum = 0, out_sum = 0;
+    long bad = 0;
+
+    #pragma omp parallel reduction(+:in_sum, out_sum, bad)
+    {
+        struct chunk c;
+        char *scratch = verify ? malloc(window) : NULL;
+
+        memset(&c, 0, sizeof(c));
+        #pragma omp for schedule(dynamic)
+        for (w = 0; w < nwin; w++) {
+            size_t off = (size_t) w * window;
+            size_t n = len - off < window ? len - off : window;
+
+            memcpy(dst + off, src + off, n);
+            c.data = dst + off;
+            c.area = n;
+            c.width = n;
+            c.height = 1;
+            c.key = 0;
+            enc->encode_handler(&c);
+            in_sum += c.checksum;
+            c.key = key;
+            enc->encode_handler(&c);
+            out_sum += c.checksum;
+            if (!verify)
+                continue;
+            if (scratch == NULL) {
+                bad++;
+                continue;
+            }
+            memcpy(scratch, dst + off, n);
+            c.data = scratch;
+            c.key = -key;
+            enc->encode_handler(&c);
+            bad += memcmp(scratch, src + off, n) != 0;
+        }
+        free(scratch);
+    }
+    sums->input += in_sum;
+    sums->output += out_sum;
+    sums->bad_windows += bad;
+}
+
+/* start reading [addr, addr + n) ahead, madvise wants a page aligned start */
+static int read_ahead(char *addr, size_t n)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) addr & ~(page - 1);
+
+    return madvise((void *) start, n + ((uintptr_t) addr - start), MADV_WILLNEED);
+}
+
+/*
+ * mmap the input and encode it to the output in --width x --height byte
+ * windows. A regular output file is mapped too and written in place, any
+ * other output (a pipe, "-" for stdout) gets the windows in batches.
+ */
+static int cmd_file(struct command_opts *opts)
+{
+    int ret = 0;
+    int in_fd = -1, out_fd = -1;
+    int mapped_out = 0;
+    int ahead = 1;
+    char *src = MAP_FAILED, *dst = MAP_FAILED;
+    char *buf = NULL;
+    size_t len, off, n, batch;
+    size_t window = (size_t) opts->width * opts->height;
+    struct stat st, out_st;
+    struct timeval t1, t2, dt;
+    struct file_sums sums = { 0, 0, 0 };
+    char key = opts->decode ? -opts->key : opts->key;
+    double elapsed;
+    const struct encoder_def *enc = opts->enc ? opts->enc : lookup_func(DEFAULT_FILE_FUNC);
+
+    if (opts->input == NULL) {
+        fprintf(stderr, "file: --input is required\n");
+        goto err;
+    }
+    gettimeofday(&t1, NULL);
+    in_fd = open(opts->input, O_RDONLY);
+    if (in_fd < 0 || fstat(in_fd, &st) < 0) {
+        perror(opts->input);
+        goto err;
+    }
+    len = st.st_size;
+
+    if (strcmp(opts->output, "-") == 0) {
+        out_fd = STDOUT_FILENO;
+    } else {
+        /* O_TRUNC would empty the input under the mapping */
+        if (stat(opts->output, &out_st) == 0 &&
+                out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) {
+            fprintf(stderr, "file: %s is both the input and the output\n", opts->output);
+            goto err;
+        }
+        out_fd = open(opts->output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0 || fstat(out_fd, &st) < 0) {
+            perror(opts->output);
+            goto err;
+        }
+        mapped_out = S_ISREG(st.st_mode);
+    }
+
+    if (len > 0) {
+        src = mmap(NULL, len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (src == MAP_FAILED) {
+            perror("mmap input failed");
+            goto err;
+        }
+        madvise(src, len, MADV_SEQUENTIAL);
+    }
+    if (mapped_out && len > 0) {
+        if (ftruncate(out_fd, len) < 0) {
+            perror("ftruncate failed");
+            goto err;
+        }
+        dst = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if (dst == MAP_FAILED) {
+            perror("mmap output failed");
+            goto err;
+        }
+        madvise(dst, len, MADV_SEQUENTIAL);
+    } else if (len > 0) {
+        buf = malloc(window * FILE_BATCH);
+        if (buf == NULL)
+            goto err;
+    }
+
+    batch = window * FILE_BATCH;
+    for (off = 0; off < len; off += n) {
+        n = len - off < batch ? len - off : batch;
+        /* start reading the next batch while this one is encoded */
+        if (ahead && off + n < len &&
+                read_ahead(src + off + n, len - off - n < batch ? len - off - n : batch) < 0) {
+            perror("madvise readahead failed");
+            ahead = 0;
+        }
+        if (mapped_out) {
+            encode_windows(src + off, dst + off, n, window, enc, key, opts->verify, &sums);
+        } else {
+            encode_windows(src + off, buf, n, window, enc, key, opts->verify, &sums);
+            if (write_all(out_fd, buf, n) < 0)
+                goto err;
+        }
+    }
+    if (dst != MAP_FAILED && munmap(dst, len) < 0) {
+        perror("munmap output failed");
+        goto err;
+    }
+    dst = MAP_FAILED;
+    gettimeofday(&t2, NULL);
+
+    dt = time_sub(t2, t1);
+    elapsed = dt.tv_sec + dt.tv_usec / (double) MICROSECONDS_PER_SECOND;
+    fprintf(stderr, "%s %s: %zu bytes in %.3f s, %.2f GB/s, window %zu, %d threads\n",
+            opts->decode ? "decoded" : "encoded", opts->input, len, elapsed,
+            elapsed > 0 ? len / elapsed / 1e9 : 0, window, opts->nb_thread);
+    fprintf(stderr, "checksum input=%"PRIu64" output=%"PRIu64"\n", sums.input, sums.output);
+    if (opts->verify) {
+        fprintf(stderr, "%s roundtrip, %ld window(s) differ\n",
+                sums.bad_windows ? "FAIL" : "PASS", sums.bad_windows);
+        if (sums.bad_windows)
+            ret = -1;
+    }
+
+done:
+    if (dst != MAP_FAILED)
+        munmap(dst, len);
+    if (src != MAP_FAILED)
+        munmap(src, len);
+    free(buf);
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd > STDOUT_FILENO)
+        close(out_fd);
+    return ret;
+err:
+    ret = -1;
+    goto done;
+}
+
 static const struct command_def cmd_check_def =
 { .name = "check", .handler = cmd_check };
 
 static const struct command_def cmd_benchmark_def =
 { .name = "benchmark", .handler = cmd_benchmark };
 
+static const struct command_def cmd_file_def =
+{ .name = "file", .handler = cmd_file };
+
 static const struct command_def cmd_def_last =
 { .name = NULL, .handler = NULL };
 
 static const struct command_def * const commands[] = {
         &cmd_benchmark_def,
         &cmd_check_def,
+        &cmd_file_def,
         &cmd_def_last
 };
 
@@ -339,27 +791,23 @@ static const struct command_def *lookup_cmd(const char *name)
     return NULL;
 }
 
-static const struct encoder_def *lookup_func(const char *name)
-{
-    int i;
-    for (i = 0; encoders[i].name != NULL; i++) {
-        if (strcmp(encoders[i].name, name) == 0)
-            return &encoders[i];
-    }
-    return NULL;
-}
-
 static void dump_opts(struct command_opts *opts)
 {
     printf("%10s %s\n", "option", "value");
     printf("%10s %s\n", "cmd", opts->cmd->name);
     printf("%10s %d\n", "thread", opts->nb_thread);
-    printf("%10s %d\n", "height", opts->height);
-    printf("%10s %d\n", "width", opts->width);
+    printf("%10s %zu\n", "height", opts->height);
+    printf("%10s %zu\n", "width", opts->width);
     printf("%10s %d\n", "size", opts->repeat);
     printf("%10s %d\n", "max", opts->max);
     printf("%10s %d\n", "hyperthread", opts->hyperthread);
+    printf("%10s %s\n", "placement", topology_name(placement(opts)));
+    printf("%10s %s\n", "numa", numa_name(opts->numa));
+    printf("%10s %d\n", "hugepages", opts->hugepages);
     printf("%10s %s\n", "output", opts->output);
+    if (opts->input != NULL)
+        printf("%10s %s\n", "input", opts->input);
+    printf("%10s %d\n", "key", opts->key);
     if (opts->enc != NULL)
         printf("%10s %s\n", "func", opts->enc->name);
 }
@@ -386,7 +834,14 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
             { "max",	 1, 0, 'm' },
             { "func",	 1, 0, 'f' },
             { "hyperthread", 1, 0, 'n' },
+            { "placement", 1, 0, 'p' },
+            { "numa",    1, 0, 'N' },
+            { "hugepages", 0, 0, 'H' },
             { "output",  1, 0, 'o' },
+            { "input",   1, 0, 'i' },
+            { "key",     1, 0, 'k' },
+            { "decode",  0, 0, 'd' },
+            { "verify",  0, 0, 'V' },
             { "verbose", 0, 0, 'v' },
             { 0, 0, 0, 0}
     };
@@ -400,8 +855,10 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
     opts->nb_thread = DEFAULT_NB_THREAD;
     opts->cmd = lookup_cmd(DEFAULT_CMD);
     opts->enc = NULL;
+    opts->key = DEFAULT_KEY;
+    opts->placement = -1;
 
-    while ((opt = getopt_long(argc, argv, "hvn:x:y:r:c:t:m:f:o:", options, &idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvdVHn:x:y:r:c:t:m:f:o:i:k:p:N:", options, &idx)) != -1) {
         switch(opt) {
         case 'c':
             opts->cmd = lookup_cmd(optarg);
@@ -410,10 +867,10 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
             opts->nb_thread = atoi(optarg);
             break;
         case 'y':
-            opts->height = atoi(optarg);
+            opts->height = strtoull(optarg, NULL, 0);
             break;
         case 'x':
-            opts->width = atoi(optarg);
+            opts->width = strtoull(optarg, NULL, 0);
             break;
         case 'r':
             opts->repeat = atoi(optarg);
@@ -427,9 +884,41 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
         case 'n':
             opts->hyperthread = atoi(optarg);
             break;
+        case 'N':
+            if (strcmp(optarg, "touch") == 0) {
+                opts->numa = CHUNK_FIRST_TOUCH;
+            } else if (strcmp(optarg, "interleave") == 0) {
+                opts->numa = CHUNK_INTERLEAVE;
+            } else if (strcmp(optarg, "none") != 0) {
+                fprintf(stderr, "unknown numa placement %s\n", optarg);
+                ret = -1;
+            }
+            break;
+        case 'H':
+            opts->hugepages = 1;
+            break;
+        case 'p':
+            opts->placement = topology_lookup(optarg);
+            if (opts->placement < 0) {
+                fprintf(stderr, "unknown placement %s\n", optarg);
+                ret = -1;
+            }
+            break;
         case 'o':
             opts->output = strdup(optarg);
             break;
+        case 'i':
+            opts->input = strdup(optarg);
+            break;
+        case 'k':
+            opts->key = atoi(optarg);
+            break;
+        case 'd':
+            opts->decode = 1;
+            break;
+        case 'V':
+            opts->verify = 1;
+            break;
         case 'h':
             usage();
             break;
@@ -455,9 +944,20 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
         ret = -1;
     }
 
+    if (opts->output == NULL && opts->cmd != NULL && opts->cmd->handler == cmd_file &&
+            opts->input != NULL) {
+        if (asprintf(&opts->output, "%s%s", opts->input, FILE_SUFFIX) < 0)
+            opts->output = NULL;
+    }
     if (opts->output == NULL)
         opts->output = strdup(DEFAULT_OUTPUT);
 
+    opts->topo = topology_load();
+    if (opts->topo == NULL)
+        fprintf(stderr, "warning: cannot read the cpu topology, threads not pinned\n");
+    else if (opts->verbose)
+        topology_dump(opts->topo);
+
     if (opts->cmd == NULL) {
         printf("Select a command to run\n");
         ret = -1;
@@ -472,6 +972,8 @@ done:
     return ret;
 err:
     free(opts->output);
+    free(opts->input);
+    topology_free(opts->topo);
     ret = -1;
     goto done;
 }
@@ -492,6 +994,8 @@ int main(int argc, char **argv)
     }
     fprintf(stderr, "done\n");
     free(opts.output);
+    free(opts.input);
+    topology_free(opts.topo);
     return EXIT_SUCCESS;
 
 err:
@@ -0,0 +1,369 @@
+/*
+ * pmu.c
+ *
+ * Every thread of the team opens its own counters (pid 0, any cpu), so
+ * the counts follow the thread wherever it runs and the benchmark can
+ * compare the threads of one encoder. The events of a thread form one
+ * group led by the task clock, so they are scheduled on the pmu together
+ * and the ratios between them come from the same window. Enabling and
+ * reading go through the file descriptors and work from the master thread.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "pmu.h"
+
+/* an encoder is pointed out when it is this many times worse than the best */
+#define PMU_HITM_RATIO      8.0
+#define PMU_HITM_MIN        0.5     /* HITM per KiB */
+#define PMU_L1D_RATIO       4.0
+#define PMU_L1D_MIN         1.0     /* L1D misses per KiB */
+#define PMU_IPC_RATIO       0.5
+#define PMU_SLOW_RATIO      8.0
+#define PMU_IMBALANCE       1.5     /* busiest thread over the mean */
+
+struct pmu_set {
+    int nthreads;
+    int fd[][PMU_NR_EVENTS];
+};
+
+static const char *event_names[PMU_NR_EVENTS] = {
+    [PMU_TASK_CLOCK]   = "task_clock",
+    [PMU_CYCLES]       = "cycles",
+    [PMU_INSTRUCTIONS] = "instructions",
+    [PMU_L1D_MISSES]   = "l1d_misses",
+    [PMU_HITM]         = "hitm",
+};
+
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+        int group_fd, unsigned long flags)
+{
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/*
+ * There is no generic HITM event. On the Intel big cores since Sandy Bridge
+ * it is MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM (XSNP_FWD on Ice Lake and later),
+ * event 0xd2 umask 0x04. The same encoding counts something else on Atom,
+ * Xeon Phi and the hybrid parts, so only the models below get it by default.
+ * ENCODE_PMU_HITM=0x<raw config> selects another encoding, 0 disables it.
+ */
+static const unsigned char hitm_models[] = {
+    0x2a, 0x2d,                         /* Sandy Bridge */
+    0x3a, 0x3e,                         /* Ivy Bridge */
+    0x3c, 0x3f, 0x45, 0x46,             /* Haswell */
+    0x3d, 0x47, 0x4f, 0x56,             /* Broadwell */
+    0x4e, 0x5e, 0x55,                   /* Skylake, Cascade Lake */
+    0x8e, 0x9e, 0xa5, 0xa6,             /* Kaby, Coffee, Comet Lake */
+    0x66, 0x6a, 0x6c, 0x7d, 0x7e,       /* Cannon, Ice Lake */
+    0x8c, 0x8d, 0xa7,                   /* Tiger, Rocket Lake */
+    0x8f, 0xcf,                         /* Sapphire, Emerald Rapids */
+};
+
+static int hitm_config(uint64_t *config)
+{
+    const char *env = getenv("ENCODE_PMU_HITM");
+
+    if (env != NULL) {
+        *config = strtoull(env, NULL, 0);
+        return *config != 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx, model;
+    size_t i;
+
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx) || ebx != 0x756e6547 /* Genu */ ||
+            !__get_cpuid(1, &eax, &ebx, &ecx, &edx) || ((eax >> 8) & 0xf) != 6)
+        return 0;
+    model = ((eax >> 12) & 0xf0) | ((eax >> 4) & 0xf);
+    for (i = 0; i < sizeof(hitm_models) / sizeof(hitm_models[0]); i++) {
+        if (hitm_models[i] == model) {
+            *config = 0x04d2;
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+static int event_attr(enum pmu_event ev, struct perf_event_attr *attr)
+{
+    uint64_t config;
+
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (ev) {
+    case PMU_TASK_CLOCK:
+        attr->type = PERF_TYPE_SOFTWARE;
+        attr->config = PERF_COUNT_SW_TASK_CLOCK;
+        return 1;
+    case PMU_CYCLES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        return 1;
+    case PMU_INSTRUCTIONS:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        return 1;
+    case PMU_L1D_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        return 1;
+    case PMU_HITM:
+        attr->type = PERF_TYPE_RAW;
+        if (!hitm_config(&config))
+            return 0;
+        attr->config = config;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+struct pmu_set *pmu_open(void)
+{
+    struct pmu_set *set;
+    int n = omp_get_max_threads();
+    int i, ev, any = 0;
+
+    set = malloc(sizeof(struct pmu_set) + n * sizeof(set->fd[0]));
+    if (set == NULL)
+        return NULL;
+    set->nthreads = n;
+    for (i = 0; i < n; i++)
+        for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+            set->fd[i][ev] = -1;
+
+    #pragma omp parallel private(ev)
+    {
+        struct perf_event_attr attr;
+        int id = omp_get_thread_num();
+        int leader = -1;
+
+        /* no leader, no counters for this thread */
+        if (id < n && event_attr(PMU_TASK_CLOCK, &attr))
+            leader = set->fd[id][PMU_TASK_CLOCK] = perf_event_open(&attr, 0, -1, -1, 0);
+        for (ev = PMU_TASK_CLOCK + 1; ev < PMU_NR_EVENTS && leader >= 0; ev++) {
+            /* the members follow the leader, only it is enabled */
+            if (event_attr(ev, &attr)) {
+                attr.disabled = 0;
+                set->fd[id][ev] = perf_event_open(&attr, 0, -1, leader, 0);
+            }
+        }
+    }
+
+    /* the groups are driven through their leaders, all of them are needed */
+    if (!pmu_has_event(set, PMU_TASK_CLOCK)) {
+        pmu_close(set);
+        return NULL;
+    }
+
+    /* keep an event only if every thread has it */
+    for (ev = 0; ev < PMU_NR_EVENTS; ev++) {
+        if (pmu_has_event(set, ev)) {
+            any = 1;
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (set->fd[i][ev] >= 0)
+                close(set->fd[i][ev]);
+            set->fd[i][ev] = -1;
+        }
+    }
+    if (!any) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void pmu_close(struct pmu_set *set)
+{
+    int i, ev;
+
+    if (set == NULL)
+        return;
+    for (i = 0; i < set->nthreads; i++)
+        for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+            if (set->fd[i][ev] >= 0)
+                close(set->fd[i][ev]);
+    free(set);
+}
+
+int pmu_threads(struct pmu_set *set)
+{
+    return set->nthreads;
+}
+
+int pmu_has_event(struct pmu_set *set, enum pmu_event ev)
+{
+    int i;
+
+    for (i = 0; i < set->nthreads; i++)
+        if (set->fd[i][ev] < 0)
+            return 0;
+    return 1;
+}
+
+const char *pmu_event_name(enum pmu_event ev)
+{
+    return event_names[ev];
+}
+
+/* on the leader of each thread, for its whole group */
+static void pmu_ioctl(struct pmu_set *set, unsigned long request)
+{
+    int i;
+
+    for (i = 0; i < set->nthreads; i++)
+        ioctl(set->fd[i][PMU_TASK_CLOCK], request, PERF_IOC_FLAG_GROUP);
+}
+
+void pmu_start(struct pmu_set *set)
+{
+    pmu_ioctl(set, PERF_EVENT_IOC_RESET);
+    pmu_ioctl(set, PERF_EVENT_IOC_ENABLE);
+}
+
+void pmu_stop(struct pmu_set *set)
+{
+    pmu_ioctl(set, PERF_EVENT_IOC_DISABLE);
+}
+
+void pmu_read(struct pmu_set *set, int thread, struct pmu_counts *counts)
+{
+    uint64_t val[3];        /* value, time enabled, time running */
+    int ev;
+
+    for (ev = 0; ev < PMU_NR_EVENTS; ev++) {
+        counts->count[ev] = 0;
+        if (set->fd[thread][ev] < 0)
+            continue;
+        if (read(set->fd[thread][ev], val, sizeof(val)) != sizeof(val))
+            continue;
+        if (val[2] > 0 && val[2] < val[1])
+            val[0] = (uint64_t) ((double) val[0] * val[1] / val[2]);
+        counts->count[ev] = val[0];
+    }
+}
+
+struct pmu_summary {
+    double per_kib[PMU_NR_EVENTS];
+    double ipc;
+    double imbalance;
+};
+
+static void summarize(struct pmu_counts *threads, int n, double bytes,
+        struct pmu_summary *s)
+{
+    double total[PMU_NR_EVENTS] = { 0 };
+    double busiest = 0;
+    int i, ev;
+
+    for (i = 0; i < n; i++) {
+        for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+            total[ev] += threads[i].count[ev];
+        if (threads[i].count[PMU_TASK_CLOCK] > busiest)
+            busiest = threads[i].count[PMU_TASK_CLOCK];
+    }
+    for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+        s->per_kib[ev] = total[ev] * 1024 / bytes;
+    s->ipc = total[PMU_CYCLES] > 0 ? total[PMU_INSTRUCTIONS] / total[PMU_CYCLES] : 0;
+    s->imbalance = total[PMU_TASK_CLOCK] > 0 ? busiest * n / total[PMU_TASK_CLOCK] : 1;
+}
+
+/*
+ * The reference is the encoder with the lowest cost per byte, in cycles
+ * when they are counted and in cpu time otherwise. The thread cpu time
+ * includes the spinning at the barriers, run with OMP_WAIT_POLICY=PASSIVE
+ * for the imbalance to show.
+ */
+void pmu_report(FILE *out, struct pmu_set *set, const char **names,
+        struct pmu_counts **counts, int nenc, double bytes)
+{
+    struct pmu_summary *sum, *ref;
+    enum pmu_event cost = pmu_has_event(set, PMU_CYCLES) ? PMU_CYCLES : PMU_TASK_CLOCK;
+    int n = set->nthreads;
+    int i, t, ev, flagged;
+
+    if (nenc == 0 || bytes <= 0)
+        return;
+    sum = calloc(nenc, sizeof(struct pmu_summary));
+    if (sum == NULL)
+        return;
+
+    fprintf(out, "%-8s %6s", "func", "thread");
+    for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+        if (pmu_has_event(set, ev))
+            fprintf(out, " %14s", event_names[ev]);
+    fprintf(out, "\n");
+
+    ref = &sum[0];
+    for (i = 0; i < nenc; i++) {
+        for (t = 0; t < n; t++) {
+            fprintf(out, "%-8s %6d", names[i], t);
+            for (ev = 0; ev < PMU_NR_EVENTS; ev++)
+                if (pmu_has_event(set, ev))
+                    fprintf(out, " %14"PRIu64, counts[i][t].count[ev]);
+            fprintf(out, "\n");
+        }
+        summarize(counts[i], n, bytes, &sum[i]);
+        if (sum[i].per_kib[cost] < ref->per_kib[cost])
+            ref = &sum[i];
+    }
+
+    fprintf(out, "reference %s: %.0f %s/KiB\n", names[ref - sum],
+            ref->per_kib[cost], event_names[cost]);
+    for (i = 0; i < nenc; i++) {
+        struct pmu_summary *s = &sum[i];
+        flagged = 0;
+
+        if (pmu_has_event(set, PMU_HITM) && s->per_kib[PMU_HITM] >= PMU_HITM_MIN &&
+                s->per_kib[PMU_HITM] >= PMU_HITM_RATIO * ref->per_kib[PMU_HITM]) {
+            fprintf(out, "%s: false sharing or contention, %.2f hitm/KiB (reference %.2f)\n",
+                    names[i], s->per_kib[PMU_HITM], ref->per_kib[PMU_HITM]);
+            flagged = 1;
+        } else if (pmu_has_event(set, PMU_INSTRUCTIONS) && ref->ipc > 0 &&
+                s->per_kib[cost] >= PMU_SLOW_RATIO * ref->per_kib[cost] &&
+                s->ipc < PMU_IPC_RATIO * ref->ipc) {
+            fprintf(out, "%s: stalled, ipc %.2f (reference %.2f), likely contention\n",
+                    names[i], s->ipc, ref->ipc);
+            flagged = 1;
+        }
+        if (pmu_has_event(set, PMU_L1D_MISSES) && s->per_kib[PMU_L1D_MISSES] >= PMU_L1D_MIN &&
+                s->per_kib[PMU_L1D_MISSES] >= PMU_L1D_RATIO * ref->per_kib[PMU_L1D_MISSES]) {
+            fprintf(out, "%s: poor locality, %.1f l1d misses/KiB (reference %.1f)\n",
+                    names[i], s->per_kib[PMU_L1D_MISSES], ref->per_kib[PMU_L1D_MISSES]);
+            flagged = 1;
+        }
+        if (n > 1 && s->imbalance >= PMU_IMBALANCE) {
+            fprintf(out, "%s: load imbalance, busiest thread %.1fx the mean\n",
+                    names[i], s->imbalance);
+            flagged = 1;
+        }
+        if (!flagged && s->per_kib[cost] >= PMU_SLOW_RATIO * ref->per_kib[cost]) {
+            fprintf(out, "%s: %.0fx slower than the reference, no counter to attribute it\n",
+                    names[i], s->per_kib[cost] / ref->per_kib[cost]);
+        }
+    }
+    free(sum);
+}
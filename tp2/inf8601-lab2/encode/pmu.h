@@ -0,0 +1,56 @@
+/*
+ * pmu.h
+ *
+ * Per-thread hardware counters of the OpenMP team, read in-process with
+ * perf_event_open(2)
+ */
+
+#ifndef PMU_H_
+#define PMU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum pmu_event {
+    PMU_TASK_CLOCK,         /* ns on cpu, software event, always there */
+    PMU_CYCLES,
+    PMU_INSTRUCTIONS,
+    PMU_L1D_MISSES,         /* L1D read misses */
+    PMU_HITM,               /* loads served by a modified line of another core */
+    PMU_NR_EVENTS
+};
+
+struct pmu_counts {
+    uint64_t count[PMU_NR_EVENTS];
+};
+
+struct pmu_set;
+
+/*
+ * Open the counters on every thread of the next default sized OpenMP team
+ * (call it outside of any parallel region). Events the kernel or the cpu
+ * does not support are left out; NULL only when nothing can be counted.
+ */
+struct pmu_set *pmu_open(void);
+void pmu_close(struct pmu_set *set);
+
+int pmu_threads(struct pmu_set *set);
+int pmu_has_event(struct pmu_set *set, enum pmu_event ev);
+const char *pmu_event_name(enum pmu_event ev);
+
+/* Zero and start, stop the counters of all the threads. */
+void pmu_start(struct pmu_set *set);
+void pmu_stop(struct pmu_set *set);
+
+/* Counts since the last pmu_start(), scaled if the events were multiplexed. */
+void pmu_read(struct pmu_set *set, int thread, struct pmu_counts *counts);
+
+/*
+ * Point out the encoders suffering from false sharing, contention, poor
+ * locality or imbalance, from their per-thread counts. counts[i] holds
+ * the threads of encoder i; bytes is what every encoder processed.
+ */
+void pmu_report(FILE *out, struct pmu_set *set, const char **names,
+        struct pmu_counts **counts, int nenc, double bytes);
+
+#endif /* PMU_H_ */
@@ -10,6 +10,7 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "color.h"
@@ -56,7 +57,6 @@ void value_color(struct rgb *color, float value, int interval, float interval_in
         c.b = x;
         break;
     default:
-        printf("ICI\n");
         c = white;
         break;
     }
@@ -108,6 +108,44 @@ int save_image_uchar(char *path, unsigned char *image, int width, int height)
     fclose(f);
     return 0;
 }
+
+/* RGBA32 frame, the alpha channel is dropped one row at a time */
+int save_image_rgba(char *path, unsigned char *image, int width, int height)
+{
+    FILE *f = NULL;
+    unsigned char *row = NULL;
+    int i, j;
+    int ret = 0;
+
+    if (image == NULL || path == NULL)
+        return -1;
+
+    row = malloc(width * 3);
+    if (row == NULL)
+        return -1;
+    if ((f = fopen(path, "wb")) == NULL) {
+        char *msg;
+        if (asprintf(&msg, "Failed to open %s", path) < 0)
+            perror("Failed to open output file");
+        else
+            perror(msg);
+        free(row);
+        return -1;
+    }
+
+    fprintf(f, "P6\n%d %d\n%d\n", width, height, 255);
+    for (j = 0; j < height; j++) {
+        for (i = 0; i < width; i++)
+            memcpy(&row[i * 3], &image[(j * width + i) * 4], 3);
+        if (fwrite(row, 3, width, f) != (size_t) width) {
+            ret = -1;
+            break;
+        }
+    }
+    fclose(f);
+    free(row);
+    return ret;
+}
 /*
  * Set the maximum value for the color scale
  * The minimum color scale is 0
@@ -126,17 +164,120 @@ float get_color_interval_inv(float max)
     return (float) 4 / max;
 }
 
+/*
+ * Tabulate value_color() for every integer value of the scale. Values are
+ * truncated to an integer by the lookup, as value_color() already does for
+ * the position inside an interval.
+ */
+struct color_lut *make_color_lut(int interval, float interval_inv)
+{
+    int v;
+    struct color_lut *lut = calloc(1, sizeof(struct color_lut));
+    if (lut == NULL)
+        return NULL;
+    /* first value mapped to the default (white) case */
+    lut->size = 5 * interval;
+    while ((int)(lut->size * interval_inv) < 5)
+        lut->size++;
+    lut->white = lut->size;
+    lut->black = lut->size + 1;
+    lut->table = calloc(lut->size + 2, sizeof(struct rgb));
+    lut->table32 = calloc(lut->size + 2, sizeof(uint32_t));
+    if (lut->table == NULL || lut->table32 == NULL) {
+        free_color_lut(lut);
+        return NULL;
+    }
+    for (v = 0; v < lut->size; v++)
+        value_color(&lut->table[v], (float) v, interval, interval_inv);
+    lut->table[lut->white] = white;
+    lut->table[lut->black] = black;
+    /* byte order of the buffer, whatever the endianness */
+    for (v = 0; v < lut->size + 2; v++) {
+        unsigned char px[4] = { lut->table[v].r, lut->table[v].g, lut->table[v].b, 255 };
+        memcpy(&lut->table32[v], px, sizeof(px));
+    }
+    return lut;
+}
+
+void free_color_lut(struct color_lut *lut)
+{
+    if (lut == NULL)
+        return;
+    free(lut->table);
+    free(lut->table32);
+    free(lut);
+}
+
+/*
+ * Map n values to packed RGB. The index computation has no branch and no
+ * integer modulo; NaN fails both range comparisons and ends up on the
+ * black entry, values below -1 or past the scale on the white one.
+ */
+void value_color_array(const struct color_lut *lut, const float *values,
+        unsigned char *rgb, int n)
+{
+    int i, idx, out;
+    float v;
+    const struct rgb *table = lut->table;
+    float size = lut->size;
+
+    for (i = 0; i < n; i++) {
+        v = values[i];
+        out = v == v ? lut->white : lut->black;
+        idx = (v > -1.0f && v < size) ? (int) v : out;
+        rgb[i * 3 + 0] = table[idx].r;
+        rgb[i * 3 + 1] = table[idx].g;
+        rgb[i * 3 + 2] = table[idx].b;
+    }
+}
+
+/* same as value_color_array(), one 32-bit store per pixel */
+void value_color_array_rgba(const struct color_lut *lut, const float *values,
+        uint32_t *rgba, int n)
+{
+    int i, idx, out;
+    float v;
+    const uint32_t *table = lut->table32;
+    float size = lut->size;
+
+    for (i = 0; i < n; i++) {
+        v = values[i];
+        out = v == v ? lut->white : lut->black;
+        idx = (v > -1.0f && v < size) ? (int) v : out;
+        rgba[i] = table[idx];
+    }
+}
+
+/* n pixels of bpp bytes (3: RGB, 4: RGBA) */
+void value_color_pixels(const struct color_lut *lut, const float *values,
+        unsigned char *buf, int bpp, int n)
+{
+    if (bpp == 4)
+        value_color_array_rgba(lut, values, (uint32_t *) buf, n);
+    else
+        value_color_array(lut, values, buf, n);
+}
+
 void hue(struct rgb **image, int width, int height)
 {
     int i, j;
+    float *values;
+    struct color_lut *lut;
 
     *image = (struct rgb*) calloc(width * height, sizeof(struct rgb));
     struct rgb *img = *image;
     int interval = get_color_interval((float) height);
     float interval_inv = get_color_interval_inv((float) height);
+    values = malloc(width * sizeof(float));
+    lut = make_color_lut(interval, interval_inv);
+    if (img == NULL || values == NULL || lut == NULL)
+        goto done;
     for (j = 0; j < height; j++) {
-        for (i = 0; i < width; i++) {
-            value_color(&img[j * width + i], (float) j, interval, interval_inv);
-        }
+        for (i = 0; i < width; i++)
+            values[i] = (float) j;
+        value_color_array(lut, values, (unsigned char *) &img[j * width], width);
     }
+done:
+    free(values);
+    free_color_lut(lut);
 }
@@ -8,20 +8,43 @@
 #ifndef COLOR_H_
 #define COLOR_H_
 
+#include <stdint.h>
+
 struct rgb {
     unsigned char r;
     unsigned char g;
     unsigned char b;
 };
 
+/*
+ * Precomputed color ramp: one entry per integer value of the scale, then
+ * white for the values out of the scale and black for NaN.
+ */
+struct color_lut {
+    struct rgb *table;
+    uint32_t *table32;      /* same colors as RGBA bytes, alpha 255 */
+    int size;
+    int white;
+    int black;
+};
+
 extern const struct rgb white;
 extern const struct rgb black;
 
 int save_image(char *path, struct rgb *image, int width, int height);
 int save_image_uchar(char *path, unsigned char *image, int width, int height);
+int save_image_rgba(char *path, unsigned char *image, int width, int height);
 void value_color(struct rgb *color, float value, int interval, float interval_inv);
 void value_color_set_max(float max);
 void hue(struct rgb **image, int width, int height);
+struct color_lut *make_color_lut(int interval, float interval_inv);
+void free_color_lut(struct color_lut *lut);
+void value_color_array(const struct color_lut *lut, const float *values,
+        unsigned char *rgb, int n);
+void value_color_array_rgba(const struct color_lut *lut, const float *values,
+        uint32_t *rgba, int n);
+void value_color_pixels(const struct color_lut *lut, const float *values,
+        unsigned char *buf, int bpp, int n);
 int get_color_interval(float max);
 float get_color_interval_inv(float max);
 #endif /* COLOR_H_ */
@@ -27,6 +27,10 @@
 #include "sinoscope_openmp.h"
 #include "sinoscope_opencl.h"
 #include "sinoscope_serial.h"
+#include "sinoscope_separable.h"
+#include "sinoscope_hybrid.h"
+#include "stream.h"
+#include "topology.h"
 #include "color.h"
 #include "memory.h"
 #include "util.h"
@@ -37,17 +41,32 @@
 #define DEFAULT_WIDTH 	512
 #define DEFAULT_LIB_NAME "serial"
 #define DEFAULT_CMD_NAME "gui"
+#define DEFAULT_KERNEL_NAME "direct"
 #define DEFAULT_IMG_PATH "sinoscope.ppm"
+#define DEFAULT_STREAM_PATH "-"
+#define DEFAULT_FORMAT_NAME "raw"
+#define DEFAULT_LAYOUT_NAME "rgb"
+#define DEFAULT_PRECISION_NAME "double"
 #define DEFAULT_TAYLOR 3
 #define DEFAULT_ITER 10
+#define DEFAULT_SCHEDULE_NAME "static"
+#define DEFAULT_DEPTH 2
+#define STREAM_SLOTS 4
+#define STREAM_FPS 30
+#define MAX_BENCH_THREADS 64
+#define MAX_BENCH_LIST 16
+#define DEFAULT_WARMUP 2
+#define DEFAULT_TOLERANCE 0.001
+#define DEFAULT_REPORT_NAME "csv"
+#define DEFAULT_PLACEMENT_NAME "none"
 #define TITLE "inf8601-lab2"
 #define FPS_DELAY 3000
-#define BYTE_PER_PIX 3
 #define MICROSECONDS 1000000
 
 static int win_x, win_y, win_id;
 static sinoscope_t *global_bl = NULL;
 static GLuint tex = 0;
+static GLuint pbo = 0;
 static int enable_display = 1;
 static struct timeval fpsStart;
 static long fpsCount = 0;
@@ -55,10 +74,32 @@ static float max = 1000000.0;
 static float amp = 200.0;
 static const struct command_def * const commands[];
 
-struct stats {
-	struct timeval elapsed;
-	struct timeval user;
-	struct timeval system;
+/* one benchmark run: a lib at a thread count, frame size and taylor terms */
+struct bench_result {
+	const char *lib;
+	const char *layout;
+	const char *precision;
+	int threads;
+	int width;
+	int height;
+	int taylor;
+	int frames;
+	double mean;
+	double p50;
+	double p95;
+	double p99;
+	double min;
+	double max;
+	double mpixels;
+	double store_mib;
+	double mismatch;
+	int max_error;
+	int valid;
+};
+
+enum bench_report {
+	REPORT_CSV,
+	REPORT_JSON,
 };
 
 enum thread_lib {
@@ -66,6 +107,9 @@ enum thread_lib {
 	LIB_SERIAL,
 	LIB_OPENMP,
 	LIB_OPENCL,
+	LIB_SEPARABLE,
+	LIB_OPENCL_PIPE,
+	LIB_HYBRID,
 };
 
 struct command_opts {
@@ -76,8 +120,33 @@ struct command_opts {
 	int height;
 	int width;
 	int taylor;
+	int kernel;
 	int iter;
 	int verbose;
+	const struct schedule_def *schedule;
+	int chunk;
+	int depth;
+	char *device;
+	int format;
+	int layout;
+	int layouts[MAX_BENCH_LIST];
+	int nlayouts;
+	int precision;
+	int precisions[MAX_BENCH_LIST];
+	int nprecisions;
+	const struct lib_def *bench_libs[MAX_BENCH_LIST];
+	int nlibs;
+	int threads[MAX_BENCH_LIST];
+	int nthreads;
+	int sizes[MAX_BENCH_LIST][2];
+	int nsizes;
+	int taylors[MAX_BENCH_LIST];
+	int ntaylors;
+	int warmup;
+	int report;
+	double tolerance;
+	int placement;
+	struct topology *topo;
 };
 
 typedef int (*sinoscope_handler)(sinoscope_t *);
@@ -86,14 +155,69 @@ struct lib_def {
 	const char *name;
 	enum thread_lib type;
 	sinoscope_handler handler;
+	sinoscope_handler flush;
+	int threaded;
+	int precision;		/* follows --precision, else always float */
 };
 
 static struct command_opts *global_opts = NULL;
 
+static const char * const kernels[] = {
+		[KERNEL_DIRECT] = "direct",
+		[KERNEL_RECURRENCE] = "recurrence",
+		NULL,
+};
+
+struct schedule_def {
+	const char *name;
+	omp_sched_t kind;
+};
+
+static const char * const formats[] = {
+		[STREAM_RAW] = "raw",
+		[STREAM_Y4M] = "y4m",
+		NULL,
+};
+
+static const char * const layouts[] = {
+		[LAYOUT_RGB] = "rgb",
+		[LAYOUT_RGBA] = "rgba",
+		NULL,
+};
+
+static const char * const precisions[] = {
+		[PRECISION_FLOAT] = "float",
+		[PRECISION_DOUBLE] = "double",
+		NULL,
+};
+
+static const char * const reports[] = {
+		[REPORT_CSV] = "csv",
+		[REPORT_JSON] = "json",
+		NULL,
+};
+
+static const struct schedule_def schedules[] = {
+		{ .name = "static", .kind = omp_sched_static },
+		{ .name = "dynamic", .kind = omp_sched_dynamic },
+		{ .name = "guided", .kind = omp_sched_guided },
+		{ .name = "auto", .kind = omp_sched_auto },
+		{ .name = NULL },
+};
+
 static const struct lib_def libs[] = {
-		{ .name = "serial", .type = LIB_SERIAL, .handler = sinoscope_image_serial },
-		{ .name = "openmp", .type = LIB_OPENMP, .handler = sinoscope_image_openmp },
+		{ .name = "serial", .type = LIB_SERIAL, .handler = sinoscope_image_serial,
+		  .precision = 1 },
+		{ .name = "openmp", .type = LIB_OPENMP, .handler = sinoscope_image_openmp, .threaded = 1,
+		  .precision = 1 },
 		{ .name = "opencl", .type = LIB_OPENCL, .handler = sinoscope_image_opencl },
+		{ .name = "separable", .type = LIB_SEPARABLE, .handler = sinoscope_image_separable,
+		  .threaded = 1, .precision = 1 },
+		{ .name = "opencl_pipe", .type = LIB_OPENCL_PIPE, .handler = sinoscope_image_opencl_pipeline,
+		  .flush = sinoscope_flush_opencl_pipeline },
+		{ .name = "hybrid", .type = LIB_HYBRID, .handler = sinoscope_image_hybrid, .threaded = 1,
+		  .precision = 1 },
+		{ .name = NULL },
 };
 
 typedef int (*cmd_handler)(struct command_opts*);
@@ -101,6 +225,7 @@ typedef int (*cmd_handler)(struct command_opts*);
 struct command_def {
 	const char 			*name;
 	cmd_handler 		handler;
+	const char 			*output;
 };
 
 __attribute__((noreturn))
@@ -110,36 +235,102 @@ static void usage(void)
 	fprintf(stderr, "Usage: " PROGNAME " [OPTIONS] [COMMAND]\n");
 	fprintf(stderr, "\nOptions:\n");
 	fprintf(stderr, "  --help	this help\n");
-	fprintf(stderr, "  --cmd		command [ gui | benchmark | image ]\n");
+	fprintf(stderr, "  --cmd		command [ gui | benchmark | image | stream ]\n");
 	fprintf(stderr, "  --lib		set the threading library to use "\
-			"[ serial | openmp | opencl ]\n");
-	fprintf(stderr, "  --output set image path output\n");
+			"[ serial | openmp | opencl | separable | opencl_pipe | hybrid ]\n"\
+			"		(benchmark: comma separated list, default all;\n"\
+			"		 other commands take a single library)\n");
+	fprintf(stderr, "  --output set image, stream or report path output (- for stdout)\n");
 	fprintf(stderr, "  --height	set height\n");
 	fprintf(stderr, "  --width	set width\n");
-	fprintf(stderr, "  --taylor	set taylor series terms\n");
-	fprintf(stderr, "  --iter 	set number of benchmark iterations\n");
+	fprintf(stderr, "  --taylor	set taylor series terms (benchmark: comma separated list)\n");
+	fprintf(stderr, "  --kernel	set taylor series evaluation "\
+			"[ direct | recurrence ]\n");
+	fprintf(stderr, "  --iter 	set number of benchmark iterations or streamed frames\n");
+	fprintf(stderr, "  --schedule	set openmp schedule "\
+			"[ static | dynamic | guided | auto ]\n");
+	fprintf(stderr, "  --chunk	set openmp schedule chunk size (0: default)\n");
+	fprintf(stderr, "  --depth	set frames in flight for opencl_pipe (1 to %d)\n",
+			PIPELINE_MAX_DEPTH);
+	fprintf(stderr, "  --device	set opencl device "\
+			"[ gpu | cpu | accel | all | <name> ][:<index>]\n");
+	fprintf(stderr, "  --format	set stream format [ raw | y4m ]\n");
+	fprintf(stderr, "  --layout	set frame buffer layout [ rgb | rgba ] "\
+			"(benchmark: comma separated list)\n");
+	fprintf(stderr, "  --precision	set cpu arithmetic [ float | double ] "\
+			"(benchmark: comma separated list)\n");
+	fprintf(stderr, "  --threads	set benchmark thread counts, comma separated "\
+			"(default 1, 2, 4 ... %d)\n", MAX_BENCH_THREADS);
+	fprintf(stderr, "  --sizes	set benchmark frame sizes, e.g. 512x512,1024x768\n");
+	fprintf(stderr, "  --warmup	set benchmark frames before timing (default %d)\n",
+			DEFAULT_WARMUP);
+	fprintf(stderr, "  --report	set benchmark report format [ csv | json ]\n");
+	fprintf(stderr, "  --placement	pin the openmp threads "\
+			"[ none | compact | scatter | core | socket ] (default %s)\n",
+			DEFAULT_PLACEMENT_NAME);
+	fprintf(stderr, "  --tolerance	set fraction of pixels allowed to differ from serial "\
+			"(default %g)\n", DEFAULT_TOLERANCE);
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Pin the threads of the next team of the default size, the master
+ * included, see topology.h. The threads the master starts afterwards
+ * inherit its cpu: the stream writer gives itself every cpu back, and
+ * init_lib() and run_gui() unpin the master while the OpenCL, GLUT and
+ * GLX libraries start theirs.
+ */
+static void pin_openmp(struct command_opts *opts)
+{
+	if (opts->placement == TOPO_NONE)
+		return;
+	#pragma omp parallel
+	{
+		topology_pin(opts->topo, opts->placement, omp_get_thread_num());
+	}
+}
+
+static int layout_bpp(int layout)
+{
+	return layout == LAYOUT_RGBA ? 4 : 3;
+}
+
 static int init_lib(struct command_opts *opts)
 {
 	int ret = 0;
 	if (opts == NULL)
 		return -1;
 
+	topology_unpin(opts->topo);
 	switch (opts->lib->type) {
 	case LIB_SERIAL:
 	case LIB_OPENMP:
+	case LIB_SEPARABLE:
 		break;
 	case LIB_OPENCL:
-		ret = opencl_init(opts->width, opts->height);
+		ret = opencl_init(opts->width, opts->height, layout_bpp(opts->layout));
 		ERR_THROW(0, ret, "init_data error");
+		break;
+	case LIB_OPENCL_PIPE:
+		ret = opencl_init(opts->width, opts->height, layout_bpp(opts->layout));
+		ERR_THROW(0, ret, "opencl_init error");
+		ret = opencl_pipeline_init(opts->width, opts->height, layout_bpp(opts->layout),
+				opts->depth);
+		ERR_THROW(0, ret, "opencl_pipeline_init error");
+		break;
+	case LIB_HYBRID:
+		ret = opencl_init(opts->width, opts->height, layout_bpp(opts->layout));
+		ERR_THROW(0, ret, "opencl_init error");
+		hybrid_reset();
+		break;
 	default:
 		break;
 	}
+	topology_pin(opts->topo, opts->placement, 0);
 	return 0;
 	error:
+	topology_pin(opts->topo, opts->placement, 0);
 	return -1;
 }
 
@@ -151,8 +342,11 @@ static int close_lib(struct command_opts *opts)
 	switch (opts->lib->type) {
 	case LIB_SERIAL:
 	case LIB_OPENMP:
+	case LIB_SEPARABLE:
 		break;
 	case LIB_OPENCL:
+	case LIB_OPENCL_PIPE:
+	case LIB_HYBRID:
 		opencl_shutdown();
 	default:
 		break;
@@ -164,8 +358,10 @@ static int cmd_gui(struct command_opts *opts)
 {
 	int ret = 0;
 
-	ret = init_data(opts->width, opts->height, opts->taylor);
+	ret = init_data(opts->width, opts->height, opts->taylor, opts->layout);
 	ERR_THROW(0, ret, "init_data error");
+	global_bl->kernel = opts->kernel;
+	global_bl->precision = opts->precision;
 
 	init_lib(opts);
 	ERR_THROW(0, ret, "init_lib error");
@@ -189,115 +385,293 @@ struct timeval time_sub(struct timeval t1, struct timeval t2)
 	return res;
 }
 
-void write_stats_header(FILE *f)
+static double elapsed_ms(struct timespec t1, struct timespec t2)
 {
-	fprintf(f, "experiment,width,height,iter,u,s,e\n");
+	return (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) * 1e-6;
 }
 
-void write_stats_info(FILE *f, char *name, int width, int height, int iter)
+static int cmp_double(const void *a, const void *b)
 {
-	fprintf(f, "%s,%d,%d,%d,", name, width, height, iter);
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
 }
 
-void write_stats(FILE *f, struct stats *s)
+/* nearest-rank percentile of n sorted values */
+static double percentile(const double *sorted, int n, double p)
 {
-	if (s == NULL)
-		return;
-	fprintf(f, "%ld.%06ld,%ld.%06ld,%ld.%06ld\n",
-			s->user.tv_sec, s->user.tv_usec,
-			s->system.tv_sec, s->system.tv_usec,
-			s->elapsed.tv_sec, s->elapsed.tv_usec);
+	int rank = (int) ceil(p / 100.0 * n);
+	if (rank < 1)
+		rank = 1;
+	return sorted[rank - 1];
 }
 
-int run_benchmark(struct stats *s, sinoscope_t *sinoscope, sinoscope_handler handler, int iter)
+/*
+ * Fraction of the pixels that differ from the reference, and largest
+ * difference of a channel in max_error. The CPU backends leave the border
+ * untouched, so only the interior is compared, and only the color
+ * channels when the layouts differ.
+ */
+static double frame_mismatch(const sinoscope_t *ref, const sinoscope_t *b, int *max_error)
 {
-	int ret = 0;
+	int x, y, c;
+	long diff = 0;
+	long n = 0;
+	const unsigned char *p, *q;
+
+	*max_error = 0;
+	for (x = 1; x < ref->height - 1; x++) {
+		for (y = 1; y < ref->width - 1; y++) {
+			p = &ref->buf[ref->bpp * (y + x * ref->width)];
+			q = &b->buf[b->bpp * (y + x * b->width)];
+			diff += p[0] != q[0] || p[1] != q[1] || p[2] != q[2];
+			for (c = 0; c < 3; c++) {
+				if (abs(p[c] - q[c]) > *max_error)
+					*max_error = abs(p[c] - q[c]);
+			}
+			n++;
+		}
+	}
+	return n > 0 ? (double) diff / n : 0;
+}
+
+/*
+ * Validate one lib against ref (serial output of the first frame), run
+ * the warmup frames, then time --iter frames one by one.
+ */
+static int run_benchmark(struct command_opts *opts, const sinoscope_t *ref,
+		struct bench_result *res, double *lat)
+{
+	const struct lib_def *lib = opts->lib;
+	sinoscope_t *b = NULL;
+	struct timespec t1, t2, start;
 	int i;
-	struct rusage r1, r2;
-	struct timeval t1, t2;
+	int ret = 0;
 
-	gettimeofday(&t1, NULL);
-	if (getrusage(RUSAGE_SELF, &r1) < 0) {
-		perror("getrusage failed");
-		goto err;
-	}
+	b = make_sinoscope(res->width, res->height, res->taylor, amp, opts->layout);
+	ERR_NOMEM(b);
+	b->kernel = opts->kernel;
+	b->precision = opts->precision;
+	b->name = (char *) lib->name;
 
-	for(i = 0; i < iter; i++) {
-		printf("%-10s %3.0f %%\r", sinoscope->name, (100 * i) / (float) iter);
-		fflush(stdout);
-		handler(sinoscope);
-	}
-	printf("%-10s %3.0f %%\n", sinoscope->name, 100.0);
+	/* same state as ref: fresh sinoscope, one step */
+	sinoscope_corners(b);
+	ret = lib->handler(b);
+	if (ret == 0 && lib->flush != NULL)
+		ret = lib->flush(b);
+	ERR_THROW(0, ret, "handler returned error");
+	res->mismatch = frame_mismatch(ref, b, &res->max_error);
+	res->valid = res->mismatch <= opts->tolerance;
 
-	if (getrusage(RUSAGE_SELF, &r2) < 0) {
-		perror("getrusage failed");
-		goto err;
+	for (i = 0; i < opts->warmup && ret == 0; i++) {
+		sinoscope_corners(b);
+		ret = lib->handler(b);
 	}
-	gettimeofday(&t2, NULL);
+	if (ret == 0 && lib->flush != NULL)
+		ret = lib->flush(b);
+	ERR_THROW(0, ret, "handler returned error");
 
-	if (s != NULL) {
-		s->user    = time_sub(r2.ru_utime, r1.ru_utime);
-		s->system  = time_sub(r2.ru_stime, r1.ru_stime);
-		s->elapsed = time_sub(t2, t1);
+	/* no progress output inside the timed loop, stderr would be timed too */
+	fprintf(stderr, "%-12s %3d ...\r", lib->name, res->threads);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < opts->iter; i++) {
+		sinoscope_corners(b);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ret = lib->handler(b);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		ERR_THROW(0, ret, "handler returned error");
+		lat[i] = elapsed_ms(t1, t2);
 	}
+	if (lib->flush != NULL)
+		ret = lib->flush(b);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	ERR_THROW(0, ret, "handler returned error");
+	fprintf(stderr, "%-12s %3d done %s\n", lib->name, res->threads,
+			res->valid ? "" : "MISMATCH");
+
+	res->frames = opts->iter;
+	res->mean = 0;
+	for (i = 0; i < opts->iter; i++)
+		res->mean += lat[i] / opts->iter;
+	qsort(lat, opts->iter, sizeof(double), cmp_double);
+	res->min = lat[0];
+	res->max = lat[opts->iter - 1];
+	res->p50 = percentile(lat, opts->iter, 50);
+	res->p95 = percentile(lat, opts->iter, 95);
+	res->p99 = percentile(lat, opts->iter, 99);
+	res->mpixels = (double) res->width * res->height * opts->iter / (elapsed_ms(start, t2) * 1e3);
+	/* bytes of frame buffer written per second */
+	res->store_mib = (double) b->buf_size * opts->iter / (elapsed_ms(start, t2) * 1e-3) / (1 << 20);
 
 done:
+	free_sinoscope(b);
 	return ret;
-err:
+error:
 	ret = -1;
 	goto done;
 }
 
+static void write_report_header(FILE *f, struct command_opts *opts)
+{
+	if (opts->report == REPORT_JSON) {
+		fprintf(f, "{\n  \"version\": \"%s\",\n  \"procs\": %d,\n  \"kernel\": \"%s\",\n"
+				"  \"frames\": %d,\n  \"warmup\": %d,\n  \"tolerance\": %g,\n  \"results\": [",
+				VERSION, omp_get_num_procs(), kernels[opts->kernel], opts->iter,
+				opts->warmup, opts->tolerance);
+		return;
+	}
+	fprintf(f, "lib,layout,precision,threads,width,height,taylor,frames,mean_ms,p50_ms,p95_ms,"
+			"p99_ms,min_ms,max_ms,mpixel_s,store_mib_s,mismatch,max_error,valid\n");
+}
+
+static void write_report(FILE *f, struct command_opts *opts, struct bench_result *r, int first)
+{
+	if (opts->report == REPORT_JSON) {
+		fprintf(f, "%s\n    { \"lib\": \"%s\", \"layout\": \"%s\", \"precision\": \"%s\", "
+				"\"threads\": %d, \"width\": %d, \"height\": %d, "
+				"\"taylor\": %d, \"frames\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, "
+				"\"p95_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, "
+				"\"mpixel_s\": %.2f, \"store_mib_s\": %.2f, \"mismatch\": %.6f, "
+				"\"max_error\": %d, \"valid\": %s }",
+				first ? "" : ",", r->lib, r->layout, r->precision, r->threads, r->width,
+				r->height, r->taylor, r->frames, r->mean, r->p50, r->p95, r->p99, r->min,
+				r->max, r->mpixels, r->store_mib, r->mismatch, r->max_error,
+				r->valid ? "true" : "false");
+		return;
+	}
+	fprintf(f, "%s,%s,%s,%d,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f,%.2f,%.6f,%d,%d\n",
+			r->lib, r->layout, r->precision, r->threads, r->width, r->height, r->taylor,
+			r->frames, r->mean, r->p50, r->p95, r->p99, r->min, r->max,
+			r->mpixels, r->store_mib, r->mismatch, r->max_error, r->valid);
+}
+
+static void write_report_footer(FILE *f, struct command_opts *opts)
+{
+	if (opts->report == REPORT_JSON)
+		fprintf(f, "\n  ]\n}\n");
+}
+
+/*
+ * Every lib of --lib (all by default) at every thread count of --threads
+ * (threaded libs only), size of --sizes, terms of --taylor, layout of
+ * --layout and precision of --precision (the OpenCL libs compute in float
+ * and run once). Each run is first checked against the serial double
+ * output of the same frame.
+ */
 static int cmd_benchmark(struct command_opts *opts)
 {
 	int ret = 0;
-	sinoscope_t *b = NULL;
-	struct stats stats;
-	char fname[256];
-	sprintf(fname, "sinoscope-%d.out", getpid());
-	FILE* f = fopen(fname, "w");
-
-	write_stats_header(f);
+	int i, j, k, l, t;
+	int layout = opts->layout;
+	int precision = opts->precision;
+	int first = 1;
+	int invalid = 0;
+	int failed = 0;
+	const struct lib_def *lib = opts->lib;
+	sinoscope_t *ref = NULL;
+	struct bench_result res;
+	double *lat = NULL;
+	FILE *f = stdout;
+
+	if (opts->nlibs == 0) {
+		for (l = 0; libs[l].name != NULL && l < MAX_BENCH_LIST; l++)
+			opts->bench_libs[l] = &libs[l];
+		opts->nlibs = l;
+	}
+	if (opts->nthreads == 0) {
+		for (t = 1; t <= MAX_BENCH_THREADS && opts->nthreads < MAX_BENCH_LIST; t *= 2)
+			opts->threads[opts->nthreads++] = t;
+	}
+	if (opts->nsizes == 0) {
+		opts->sizes[0][0] = opts->width;
+		opts->sizes[0][1] = opts->height;
+		opts->nsizes = 1;
+	}
+	ERR_ASSERT(opts->iter > 0, "benchmark needs at least one iteration");
+
+	lat = malloc(opts->iter * sizeof(double));
+	ERR_NOMEM(lat);
+	if (strcmp(opts->ppm_path, "-") != 0) {
+		f = fopen(opts->ppm_path, "w");
+		if (f == NULL) {
+			perror(opts->ppm_path);
+			goto error;
+		}
+	}
 
-	b = make_sinoscope(opts->width, opts->height, opts->taylor, amp);
-	ERR_NOMEM(b);
+	write_report_header(f, opts);
+	for (i = 0; i < opts->nsizes; i++) {
+		for (j = 0; j < opts->ntaylors; j++) {
+			memset(&res, 0, sizeof(res));
+			res.width = opts->sizes[i][0];
+			res.height = opts->sizes[i][1];
+			res.taylor = opts->taylors[j];
+
+			ref = make_sinoscope(res.width, res.height, res.taylor, amp, LAYOUT_RGB);
+			ERR_NOMEM(ref);
+			ref->kernel = opts->kernel;
+			ref->precision = PRECISION_DOUBLE;
+			sinoscope_corners(ref);
+			ret = sinoscope_image_serial(ref);
+			ERR_THROW(0, ret, "serial reference failed");
+
+			/* every layout with every precision */
+			for (k = 0; k < opts->nlayouts * opts->nprecisions; k++) {
+				opts->layout = opts->layouts[k / opts->nprecisions];
+				opts->precision = opts->precisions[k % opts->nprecisions];
+				res.layout = layouts[opts->layout];
+				for (l = 0; l < opts->nlibs; l++) {
+					opts->lib = opts->bench_libs[l];
+					/* the OpenCL libs ignore the precision, one run per layout */
+					if (!opts->lib->precision && k % opts->nprecisions != 0)
+						continue;
+					res.precision = precisions[opts->lib->precision ?
+							opts->precision : PRECISION_FLOAT];
+					opts->width = res.width;
+					opts->height = res.height;
+					if (init_lib(opts) < 0) {
+						fprintf(stderr, "%s: init failed, skipped\n", opts->lib->name);
+						continue;
+					}
+					res.lib = opts->lib->name;
+					for (t = 0; t < (opts->lib->threaded ? opts->nthreads : 1); t++) {
+						res.threads = opts->lib->threaded ? opts->threads[t] : 1;
+						omp_set_num_threads(res.threads);
+						pin_openmp(opts);
+						ret = run_benchmark(opts, ref, &res, lat);
+						if (ret < 0) {
+							fprintf(stderr, "%s: benchmark failed\n", opts->lib->name);
+							failed++;
+							continue;
+						}
+						invalid += !res.valid;
+						write_report(f, opts, &res, first);
+						first = 0;
+					}
+					close_lib(opts);
+				}
+			}
+			free_sinoscope(ref);
+			ref = NULL;
+		}
+	}
+	write_report_footer(f, opts);
+	ret = invalid || failed ? -1 : 0;
+	if (invalid)
+		fprintf(stderr, "%d run(s) differ from serial by more than %g of the pixels\n",
+				invalid, opts->tolerance);
+	if (failed)
+		fprintf(stderr, "%d run(s) failed and are not reported\n", failed);
 
-	/* serial */
-	b->name = "serial";
-	write_stats_info(f, b->name, opts->width, opts->height, opts->iter);
-	run_benchmark(&stats, b, sinoscope_image_serial, opts->iter);
-	write_stats(f, &stats);
-
-	/* openmp 1 thread */
-	b->name = "openmp_1";
-	omp_set_num_threads(1);
-	write_stats_info(f, b->name, opts->width, opts->height, opts->iter);
-	run_benchmark(&stats, b, sinoscope_image_openmp, opts->iter);
-	write_stats(f, &stats);
-
-	/* openmp 8 threads */
-	b->name = "openmp_8";
-	omp_set_num_threads(8);
-	write_stats_info(f, b->name, opts->width, opts->height, opts->iter);
-	run_benchmark(&stats, b, sinoscope_image_openmp, opts->iter);
-	write_stats(f, &stats);
-
-	/* opencl */
-	b->name = "opencl";
-	ret = opencl_init(opts->width, opts->height);
-	ERR_THROW(0, ret, "opencl_init failed");
-	write_stats_info(f, b->name, opts->width, opts->height, opts->iter);
-	run_benchmark(&stats, b, sinoscope_image_opencl, opts->iter);
-	write_stats(f, &stats);
-	opencl_shutdown();
-	ERR_THROW(0, ret, "opencl_shutdown failed");
-	printf("\n");
-	fprintf(f, "\n");
-	free_sinoscope(b);
-	b = NULL;
 done:
-	free_sinoscope(b);
-	if (f != NULL)
+	opts->lib = lib;
+	opts->layout = layout;
+	opts->precision = precision;
+	omp_set_num_threads(omp_get_num_procs());
+	pin_openmp(opts);
+	free_sinoscope(ref);
+	FREE(lat);
+	if (f != NULL && f != stdout)
 		fclose(f);
 	return ret;
 error:
@@ -313,11 +687,20 @@ static int cmd_image(struct command_opts *opts)
 	ret = init_lib(opts);
 	ERR_THROW(0, ret, "init_lib error");
 
-	s = make_sinoscope(opts->width, opts->height, opts->taylor, amp);
+	s = make_sinoscope(opts->width, opts->height, opts->taylor, amp, opts->layout);
 	ERR_NOMEM(s);
+	s->kernel = opts->kernel;
+	s->precision = opts->precision;
 	ret = opts->lib->handler(s);
 	ERR_THROW(0, ret, "handler returned error");
-	ret = save_image_uchar(opts->ppm_path, s->buf, s->width, s->height);
+	if (opts->lib->flush != NULL) {
+		ret = opts->lib->flush(s);
+		ERR_THROW(0, ret, "flush returned error");
+	}
+	if (s->layout == LAYOUT_RGBA)
+		ret = save_image_rgba(opts->ppm_path, s->buf, s->width, s->height);
+	else
+		ret = save_image_uchar(opts->ppm_path, s->buf, s->width, s->height);
 	ERR_THROW(0, ret, "save image failed");
 done:
 	close_lib(opts);
@@ -328,12 +711,101 @@ error:
 	goto done;
 }
 
+/* move the oldest frame of the opencl pipeline to the stream */
+static int stream_pipeline_frame(struct frame_stream *st, size_t size)
+{
+	unsigned char *slot = stream_acquire(st);
+	unsigned char *frame = opencl_pipeline_next();
+
+	if (slot == NULL || frame == NULL)
+		return -1;
+	memcpy(slot, frame, size);
+	stream_publish(st);
+	return 0;
+}
+
+/*
+ * Render --iter frames into the slots of a frame_stream, the writer
+ * thread converts and writes them while the next ones are computed.
+ */
+static int cmd_stream(struct command_opts *opts)
+{
+	int ret;
+	int i;
+	sinoscope_t *s = NULL;
+	struct frame_stream *st = NULL;
+	struct stream_stats stats;
+	unsigned char *buf = NULL;
+	struct timespec t1, t2;
+	double elapsed;
+	int pipelined = opts->lib->type == LIB_OPENCL_PIPE;
+
+	ret = init_lib(opts);
+	ERR_THROW(0, ret, "init_lib error");
+
+	s = make_sinoscope(opts->width, opts->height, opts->taylor, amp, opts->layout);
+	ERR_NOMEM(s);
+	s->kernel = opts->kernel;
+	s->precision = opts->precision;
+	buf = s->buf;
+
+	st = stream_open(opts->ppm_path, opts->format, s->width, s->height, s->bpp,
+			STREAM_SLOTS, STREAM_FPS, opts->topo);
+	ERR_NOMEM(st);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < opts->iter; i++) {
+		sinoscope_corners(s);
+		if (pipelined) {
+			ret = opencl_pipeline_submit(s);
+			ERR_THROW(0, ret, "opencl_pipeline_submit failed");
+			if (opencl_pipeline_pending() == opts->depth) {
+				ret = stream_pipeline_frame(st, s->buf_size);
+				ERR_THROW(0, ret, "stream_pipeline_frame failed");
+			}
+			continue;
+		}
+		/* render straight into the slot */
+		s->buf = stream_acquire(st);
+		ERR_NOMEM(s->buf);
+		ret = opts->lib->handler(s);
+		ERR_THROW(0, ret, "handler returned error");
+		stream_publish(st);
+	}
+	while (pipelined && opencl_pipeline_pending() > 0) {
+		ret = stream_pipeline_frame(st, s->buf_size);
+		ERR_THROW(0, ret, "stream_pipeline_frame failed");
+	}
+	ret = stream_close(st, &stats);
+	st = NULL;
+	ERR_THROW(0, ret, "stream write failed");
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9;
+	fprintf(stderr, "%s: %ld frames in %.3f s, %.1f fps, %.1f MiB/s, writer busy %.0f %%\n",
+			opts->lib->name, stats.frames, elapsed, stats.frames / elapsed,
+			stats.bytes / elapsed / (1 << 20), 100 * stats.write_time / elapsed);
+done:
+	if (st != NULL)
+		stream_close(st, NULL);
+	if (s != NULL)
+		s->buf = buf;
+	close_lib(opts);
+	free_sinoscope(s);
+	return ret;
+error:
+	ret = -1;
+	goto done;
+}
+
 static const struct command_def cmd_gui_def =
-{ .name = "gui", .handler = cmd_gui };
+{ .name = "gui", .handler = cmd_gui, .output = DEFAULT_IMG_PATH };
 static const struct command_def cmd_benchmark_def =
-{ .name = "benchmark", .handler = cmd_benchmark };
+{ .name = "benchmark", .handler = cmd_benchmark, .output = DEFAULT_STREAM_PATH };
 static const struct command_def cmd_image_def =
-{ .name = "image", .handler = cmd_image };
+{ .name = "image", .handler = cmd_image, .output = DEFAULT_IMG_PATH };
+static const struct command_def cmd_stream_def =
+{ .name = "stream", .handler = cmd_stream, .output = DEFAULT_STREAM_PATH };
 static const struct command_def cmd_def_last =
 { .name = NULL, .handler = NULL };
 
@@ -341,6 +813,7 @@ static const struct command_def * const commands[] = {
 		&cmd_gui_def,
 		&cmd_benchmark_def,
 		&cmd_image_def,
+		&cmd_stream_def,
 		&cmd_def_last
 };
 
@@ -364,6 +837,148 @@ static const struct lib_def *lookup_lib(const char *name)
 	return NULL;
 }
 
+static int lookup_kernel(const char *name)
+{
+	int i;
+	for (i = 0; kernels[i] != NULL; i++) {
+		if (strcmp(kernels[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int lookup_report(const char *name)
+{
+	int i;
+	for (i = 0; reports[i] != NULL; i++) {
+		if (strcmp(reports[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* comma separated integers, returns the count or -1 */
+/* values below min are rejected like a syntax error */
+static int parse_int_list(const char *arg, int *list, int max, int min)
+{
+	char *end;
+	int n = 0;
+
+	while (*arg != '\0') {
+		if (n == max)
+			return -1;
+		list[n] = strtol(arg, &end, 10);
+		if (end == arg || (*end != ',' && *end != '\0') || list[n] < min)
+			return -1;
+		n++;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+/* comma separated WIDTHxHEIGHT, returns the count or -1 */
+static int parse_size_list(const char *arg, int sizes[][2], int max)
+{
+	int n = 0;
+	int len;
+
+	while (*arg != '\0') {
+		if (n == max || sscanf(arg, "%dx%d%n", &sizes[n][0], &sizes[n][1], &len) != 2)
+			return -1;
+		if (sizes[n][0] <= 0 || sizes[n][1] <= 0)
+			return -1;
+		n++;
+		arg += len;
+		if (*arg == ',')
+			arg++;
+		else if (*arg != '\0')
+			return -1;
+	}
+	return n;
+}
+
+/* comma separated lib names, returns the count or -1 */
+static int parse_lib_list(const char *arg, const struct lib_def **list, int max)
+{
+	char *names, *name, *save = NULL;
+	int n = 0;
+
+	names = strdup(arg);
+	if (names == NULL)
+		return -1;
+	for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		if (n == max || (list[n] = lookup_lib(name)) == NULL) {
+			printf("unknown threading lib %s\n", name);
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	free(names);
+	return n;
+}
+
+static int lookup_layout(const char *name)
+{
+	int i;
+	for (i = 0; layouts[i] != NULL; i++) {
+		if (strcmp(layouts[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int lookup_precision(const char *name)
+{
+	int i;
+	for (i = 0; precisions[i] != NULL; i++) {
+		if (strcmp(precisions[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* comma separated names of a table, returns the count or -1 */
+static int parse_name_list(const char *arg, int (*lookup)(const char *), int *list, int max)
+{
+	char *names, *name, *save = NULL;
+	int n = 0;
+
+	names = strdup(arg);
+	if (names == NULL)
+		return -1;
+	for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		if (n == max || (list[n] = lookup(name)) < 0) {
+			printf("unknown value %s\n", name);
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	free(names);
+	return n;
+}
+
+static int lookup_format(const char *name)
+{
+	int i;
+	for (i = 0; formats[i] != NULL; i++) {
+		if (strcmp(formats[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static const struct schedule_def *lookup_schedule(const char *name)
+{
+	int i;
+	for (i = 0; schedules[i].name != NULL; i++) {
+		if (strcmp(schedules[i].name, name) == 0)
+			return &schedules[i];
+	}
+	return NULL;
+}
+
 static void dump_opts(struct command_opts *opts)
 {
 	printf("%10s %s\n", "option", "value");
@@ -373,7 +988,19 @@ static void dump_opts(struct command_opts *opts)
 	printf("%10s %d\n", "width", opts->width);
 	printf("%10s %d\n", "height", opts->height);
 	printf("%10s %d\n", "taylor", opts->taylor);
+	printf("%10s %s\n", "kernel", kernels[opts->kernel]);
 	printf("%10s %d\n", "iter", opts->iter);
+	printf("%10s %s\n", "schedule", opts->schedule->name);
+	printf("%10s %d\n", "chunk", opts->chunk);
+	printf("%10s %d\n", "depth", opts->depth);
+	printf("%10s %s\n", "device", opts->device ? opts->device : "default");
+	printf("%10s %s\n", "format", formats[opts->format]);
+	printf("%10s %s\n", "layout", layouts[opts->layout]);
+	printf("%10s %s\n", "precision", precisions[opts->precision]);
+	printf("%10s %d\n", "warmup", opts->warmup);
+	printf("%10s %s\n", "report", reports[opts->report]);
+	printf("%10s %g\n", "tolerance", opts->tolerance);
+	printf("%10s %s\n", "placement", topology_name(opts->placement));
 }
 
 void default_int_value(int *val, int def)
@@ -387,6 +1014,7 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 	int idx;
 	int opt;
 	int ret = 0;
+	const struct schedule_def *sched;
 
 	struct option options[] = {
 			{ "help",	 0, 0, 'h' },
@@ -396,7 +1024,21 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 			{ "height",	 1, 0, 'y' },
 			{ "width",	 1, 0, 'x' },
 			{ "taylor",	 1, 0, 't' },
+			{ "kernel",	 1, 0, 'k' },
 			{ "iter",	 1, 0, 'i' },
+			{ "schedule", 1, 0, 's' },
+			{ "chunk",	 1, 0, 'u' },
+			{ "depth",	 1, 0, 'd' },
+			{ "device",	 1, 0, 'D' },
+			{ "format",	 1, 0, 'f' },
+			{ "layout",	 1, 0, 'L' },
+			{ "precision", 1, 0, 'P' },
+			{ "threads", 1, 0, 'T' },
+			{ "sizes",	 1, 0, 'S' },
+			{ "warmup",	 1, 0, 'w' },
+			{ "report",	 1, 0, 'r' },
+			{ "tolerance", 1, 0, 'e' },
+			{ "placement", 1, 0, 'p' },
 			{ "verbose", 0, 0, 'v' },
 			{ 0, 0, 0, 0}
 	};
@@ -405,18 +1047,30 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 	opts->height = DEFAULT_HEIGHT;
 	opts->width = DEFAULT_WIDTH;
 	opts->taylor = DEFAULT_TAYLOR;
+	opts->kernel = lookup_kernel(DEFAULT_KERNEL_NAME);
 	opts->iter = DEFAULT_ITER;
-
-	while ((opt = getopt_long(argc, argv, "hvx:y:c:l:o:t:i:", options, &idx)) != -1) {
+	opts->schedule = lookup_schedule(DEFAULT_SCHEDULE_NAME);
+	opts->depth = DEFAULT_DEPTH;
+	opts->format = lookup_format(DEFAULT_FORMAT_NAME);
+	opts->layout = lookup_layout(DEFAULT_LAYOUT_NAME);
+	opts->precision = lookup_precision(DEFAULT_PRECISION_NAME);
+	opts->warmup = DEFAULT_WARMUP;
+	opts->report = lookup_report(DEFAULT_REPORT_NAME);
+	opts->tolerance = DEFAULT_TOLERANCE;
+	opts->placement = topology_lookup(DEFAULT_PLACEMENT_NAME);
+
+	while ((opt = getopt_long(argc, argv, "hvx:y:c:l:o:t:k:i:s:u:d:D:f:L:P:T:S:w:r:e:p:", options, &idx)) != -1) {
 		switch(opt) {
 		case 'c':
 			opts->cmd = lookup_cmd(optarg);
 			break;
 		case 'l':
-			opts->lib = lookup_lib(optarg);
-			if (opts->lib == NULL) {
-				printf("unknown threading lib %s\n", optarg);
+			opts->nlibs = parse_lib_list(optarg, opts->bench_libs, MAX_BENCH_LIST);
+			if (opts->nlibs <= 0) {
+				opts->nlibs = 0;
 				ret = -1;
+			} else {
+				opts->lib = opts->bench_libs[0];
 			}
 			break;
 		case 'o':
@@ -430,11 +1084,110 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 			opts->width = atoi(optarg);
 			break;
 		case 't':
-			opts->taylor = atoi(optarg);
+			opts->ntaylors = parse_int_list(optarg, opts->taylors, MAX_BENCH_LIST, 0);
+			if (opts->ntaylors <= 0) {
+				printf("invalid taylor list %s\n", optarg);
+				opts->ntaylors = 0;
+				ret = -1;
+			} else {
+				opts->taylor = opts->taylors[0];
+			}
+			break;
+		case 'k':
+			opts->kernel = lookup_kernel(optarg);
+			if (opts->kernel < 0) {
+				printf("unknown kernel %s\n", optarg);
+				opts->kernel = lookup_kernel(DEFAULT_KERNEL_NAME);
+				ret = -1;
+			}
 			break;
 		case 'i':
 			opts->iter = atoi(optarg);
 			break;
+		case 's':
+			sched = lookup_schedule(optarg);
+			if (sched == NULL) {
+				printf("unknown schedule %s\n", optarg);
+				ret = -1;
+			} else {
+				opts->schedule = sched;
+			}
+			break;
+		case 'u':
+			opts->chunk = atoi(optarg);
+			break;
+		case 'd':
+			opts->depth = atoi(optarg);
+			break;
+		case 'D':
+			if (asprintf(&opts->device, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'T':
+			opts->nthreads = parse_int_list(optarg, opts->threads, MAX_BENCH_LIST, 1);
+			if (opts->nthreads <= 0) {
+				printf("invalid thread list %s\n", optarg);
+				opts->nthreads = 0;
+				ret = -1;
+			}
+			break;
+		case 'S':
+			opts->nsizes = parse_size_list(optarg, opts->sizes, MAX_BENCH_LIST);
+			if (opts->nsizes <= 0) {
+				printf("invalid size list %s\n", optarg);
+				opts->nsizes = 0;
+				ret = -1;
+			}
+			break;
+		case 'w':
+			opts->warmup = atoi(optarg);
+			break;
+		case 'r':
+			opts->report = lookup_report(optarg);
+			if (opts->report < 0) {
+				printf("unknown report %s\n", optarg);
+				opts->report = lookup_report(DEFAULT_REPORT_NAME);
+				ret = -1;
+			}
+			break;
+		case 'e':
+			opts->tolerance = atof(optarg);
+			break;
+		case 'p':
+			opts->placement = topology_lookup(optarg);
+			if (opts->placement < 0) {
+				printf("unknown placement %s\n", optarg);
+				opts->placement = TOPO_NONE;
+				ret = -1;
+			}
+			break;
+		case 'f':
+			opts->format = lookup_format(optarg);
+			if (opts->format < 0) {
+				printf("unknown format %s\n", optarg);
+				opts->format = lookup_format(DEFAULT_FORMAT_NAME);
+				ret = -1;
+			}
+			break;
+		case 'L':
+			opts->nlayouts = parse_name_list(optarg, lookup_layout, opts->layouts, MAX_BENCH_LIST);
+			if (opts->nlayouts <= 0) {
+				opts->nlayouts = 0;
+				ret = -1;
+			} else {
+				opts->layout = opts->layouts[0];
+			}
+			break;
+		case 'P':
+			opts->nprecisions = parse_name_list(optarg, lookup_precision, opts->precisions,
+					MAX_BENCH_LIST);
+			if (opts->nprecisions <= 0) {
+				opts->nprecisions = 0;
+				ret = -1;
+			} else {
+				opts->precision = opts->precisions[0];
+			}
+			break;
 		case 'h':
 			usage();
 			break;
@@ -456,13 +1209,50 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 		opts->cmd = lookup_cmd(DEFAULT_CMD_NAME);
 
 	if (opts->ppm_path == NULL)
-		opts->ppm_path = DEFAULT_IMG_PATH;
+		opts->ppm_path = (char *) opts->cmd->output;
+
+	if (opts->nlibs > 1 && opts->cmd != &cmd_benchmark_def) {
+		fprintf(stderr, "argument error: only benchmark takes a list of libs\n");
+		ret = -1;
+	}
+
+	if (opts->ntaylors == 0) {
+		opts->taylors[0] = opts->taylor;
+		opts->ntaylors = 1;
+	}
+
+	if (opts->nlayouts == 0) {
+		opts->layouts[0] = opts->layout;
+		opts->nlayouts = 1;
+	}
+
+	if (opts->nprecisions == 0) {
+		opts->precisions[0] = opts->precision;
+		opts->nprecisions = 1;
+	}
 
 	if (opts->width == 0 || opts->height == 0) {
 		fprintf(stderr, "argument error: height and width must be greater than 0\n");
 		ret = -1;
 	}
 
+	if (opts->depth < 1 || opts->depth > PIPELINE_MAX_DEPTH) {
+		fprintf(stderr, "argument error: depth must be between 1 and %d\n",
+				PIPELINE_MAX_DEPTH);
+		ret = -1;
+	}
+
+	omp_set_schedule(opts->schedule->kind, opts->chunk);
+
+	if (opts->placement != TOPO_NONE) {
+		opts->topo = topology_load();
+		if (opts->topo == NULL) {
+			fprintf(stderr, "cannot read the cpu topology, threads not pinned\n");
+			opts->placement = TOPO_NONE;
+		}
+	}
+	opencl_set_device(opts->device);
+
 	if (opts->verbose)
 		dump_opts(opts);
 	global_opts = opts;
@@ -474,20 +1264,28 @@ err:
 	goto done;
 }
 
-sinoscope_t *make_sinoscope(int width, int height, int taylor, float max)
+sinoscope_t *make_sinoscope(int width, int height, int taylor, float max, int layout)
 {
 	sinoscope_t *b = calloc(1, sizeof(sinoscope_t));
 	if (b == NULL)
 		return NULL;
-	b->buf_size = width * height * BYTE_PER_PIX;
-	b->buf = malloc(b->buf_size);
-	if (b->buf == NULL)
+	b->layout = layout;
+	b->bpp = layout_bpp(layout);
+	b->buf_size = width * height * b->bpp;
+	if (posix_memalign((void **) &b->buf, SINOSCOPE_ALIGN, b->buf_size) != 0) {
+		free_sinoscope(b);
 		return NULL;
+	}
 	b->width = width;
 	b->height = height;
 	b->max = max;
 	b->interval = get_color_interval(max);
 	b->interval_inv = get_color_interval_inv(max);
+	b->lut = make_color_lut(b->interval, b->interval_inv);
+	if (b->lut == NULL) {
+		free_sinoscope(b);
+		return NULL;
+	}
 	b->taylor = taylor;
 	b->dx = 3 * M_PI / width;
 	b->dy = 3 * M_PI / height;
@@ -496,17 +1294,20 @@ sinoscope_t *make_sinoscope(int width, int height, int taylor, float max)
 
 void free_sinoscope(sinoscope_t *b)
 {
-	if (b != NULL)
+	if (b != NULL) {
 		FREE(b->buf);
+		free_color_lut(b->lut);
+		free_series_halves(b->halves);
+	}
 	FREE(b);
 }
 
-int init_data(int width, int height, int taylor)
+int init_data(int width, int height, int taylor, int layout)
 {
 	win_x = width;
 	win_y = height;
 	if (global_bl == NULL) {
-		global_bl = make_sinoscope(width, height, taylor, amp);
+		global_bl = make_sinoscope(width, height, taylor, amp, layout);
 	}
 	if (global_bl == NULL)
 		return -1;
@@ -543,11 +1344,40 @@ void fps_update(int value)
 	struct timeval diff = time_sub(t, fpsStart);
 	double delay = diff.tv_sec + ((double) diff.tv_usec / 1000000.0);
 	sprintf(fps, TITLE " %s (%d x %d): %.1f fps", global_opts->lib->name, win_x, win_y, fpsCount / delay);
+	if (global_opts->lib->type == LIB_HYBRID)
+		sprintf(fps + strlen(fps), ", %.0f %% of the rows on the device",
+				100 * hybrid_device_share());
 	glutSetWindowTitle(fps);
 	printf("%s\n", fps);
 	glutTimerFunc(FPS_DELAY, fps_update, value);
 }
 
+/*
+ * RGBA frames are uploaded through a pixel buffer object: the texture is
+ * allocated once, the copy into the orphaned PBO returns immediately and
+ * the driver moves the pixels to the texture without repacking them.
+ */
+static void upload_rgba(sinoscope_t *b)
+{
+	void *dst;
+
+	if (pbo == 0) {
+		glGenBuffers(1, &pbo);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, b->width, b->height, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, b->buf_size, NULL, GL_STREAM_DRAW);
+	dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (dst != NULL) {
+		memcpy(dst, b->buf, b->buf_size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, b->width, b->height, GL_RGBA,
+				GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
 void draw_sinoscope(const struct lib_def *def, sinoscope_t *b)
 {
 	int ret = 0;
@@ -566,7 +1396,10 @@ void draw_sinoscope(const struct lib_def *def, sinoscope_t *b)
 	}
 	if (enable_display) {
 		glBindTexture(GL_TEXTURE_2D, tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, 3, b->width, b->height, 0, GL_RGB, GL_UNSIGNED_BYTE, b->buf);
+		if (b->layout == LAYOUT_RGBA)
+			upload_rgba(b);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, 3, b->width, b->height, 0, GL_RGB, GL_UNSIGNED_BYTE, b->buf);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 		glEnable(GL_TEXTURE_2D);
@@ -625,6 +1458,21 @@ void key_func(unsigned char key, int x, int y)
 		global_opts->lib = lookup_lib("opencl");
 		init_lib(global_opts);
 		break;
+	case '4':
+		close_lib(global_opts);
+		global_opts->lib = lookup_lib("separable");
+		init_lib(global_opts);
+		break;
+	case '5':
+		close_lib(global_opts);
+		global_opts->lib = lookup_lib("opencl_pipe");
+		init_lib(global_opts);
+		break;
+	case '6':
+		close_lib(global_opts);
+		global_opts->lib = lookup_lib("hybrid");
+		init_lib(global_opts);
+		break;
 	case ' ':
 		enable_display = !enable_display;
 		break;
@@ -698,8 +1546,10 @@ void open_glut_window()
 void run_gui(int argc, char **argv)
 {
 	init_fps();
+	topology_unpin(global_opts->topo);
 	glutInit( &argc, argv );
 	open_glut_window();
+	topology_pin(global_opts->topo, global_opts->placement, 0);
 	glutMainLoop();
 }
 
@@ -717,11 +1567,13 @@ int main(int argc, char **argv)
 		usage();
 	}
 
+	pin_openmp(&opts);
 	if ((opts.cmd->handler(&opts)) < 0) {
 		printf("Error while executing command %s\n", opts.cmd->name);
 		goto err;
 	}
 
+	topology_free(opts.topo);
 	return EXIT_SUCCESS;
 
 err:
@@ -10,14 +10,59 @@
 
 typedef struct sinoscope sinoscope_t;
 
+/* how the taylor series is evaluated, see sinoscope_taylor.h */
+enum sinoscope_kernel {
+    KERNEL_DIRECT,
+    KERNEL_RECURRENCE,
+};
+
+/*
+ * Arithmetic of the CPU backends: float variables and sinf/cosf/atanf, or
+ * double throughout (the reference). The OpenCL kernels are float only.
+ */
+enum sinoscope_precision {
+    PRECISION_FLOAT,
+    PRECISION_DOUBLE,
+};
+
+/*
+ * Pixel layout of the frame buffer: packed RGB24, or RGBA32 with alpha
+ * set to 255 so that every pixel is one aligned 32-bit store.
+ */
+enum sinoscope_layout {
+    LAYOUT_RGB,
+    LAYOUT_RGBA,
+};
+
+/* alignment of the frame buffer, one cache line */
+#define SINOSCOPE_ALIGN 64
+
+/*
+ * Per-column sin half and per-row cos half of the series, allocated with
+ * the first separable frame and reused by the next ones. Both halves are
+ * evaluated again every frame, the animation moves time and both phases.
+ */
+struct series_halves {
+    float *sin_sum;
+    float *cos_sum;
+    double *sin_sum_d;      /* same for PRECISION_DOUBLE */
+    double *cos_sum_d;
+};
+
 struct sinoscope {
     unsigned char *buf;
+    struct color_lut *lut;
+    struct series_halves *halves;
     char *name;
     int buf_size;
     int width;
     int height;
+    int layout;
+    int bpp;                /* bytes per pixel, 3 or 4 */
     int interval;
     int taylor;
+    int kernel;
+    int precision;
     float interval_inv;
     float time;
     float max;
@@ -27,9 +72,9 @@ struct sinoscope {
     float dy;
 };
 
-sinoscope_t *make_sinoscope(int width, int height, int taylor, float max);
+sinoscope_t *make_sinoscope(int width, int height, int taylor, float max, int layout);
 void free_sinoscope(sinoscope_t *b);
-int init_data(int width, int height, int taylor);
+int init_data(int width, int height, int taylor, int layout);
 int do_sinoscope(sinoscope_t *bilin);
 void sinoscope_corners(sinoscope_t *b_ptr);
 void run_gui(int argc, char **argv);
@@ -0,0 +1,98 @@
+/*
+ * sinoscope_hybrid.c
+ *
+ * The top rows of the frame are queued on the OpenCL device, then the
+ * OpenMP threads render the remaining ones while the device works. The
+ * share of the device is updated after each frame from the row rate each
+ * side achieved, so that both finish at the same time. The rates are
+ * measured while the two sides run together, which is what matters when
+ * the OpenCL device is the CPU itself.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sinoscope.h"
+#include "sinoscope_hybrid.h"
+#include "sinoscope_openmp.h"
+#include "sinoscope_opencl.h"
+
+/* share of the rows given to the device for the first frame */
+#define HYBRID_INITIAL_SHARE 0.5f
+
+/* fraction of the distance to the measured balance covered per frame */
+#define HYBRID_GAIN 0.5f
+
+/* both sides keep a few rows, otherwise their rate is no longer measured */
+#define HYBRID_MIN_SHARE 0.02f
+
+static float device_share = HYBRID_INITIAL_SHARE;
+
+void hybrid_reset(void)
+{
+    device_share = HYBRID_INITIAL_SHARE;
+}
+
+float hybrid_device_share(void)
+{
+    return device_share;
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void update_share(int device_rows, double device_time, int cpu_rows, double cpu_time)
+{
+    double device_rate, cpu_rate;
+    float target;
+
+    if (device_time <= 0 || cpu_time <= 0)
+        return;
+    device_rate = device_rows / device_time;
+    cpu_rate = cpu_rows / cpu_time;
+    target = device_rate / (device_rate + cpu_rate);
+    device_share += HYBRID_GAIN * (target - device_share);
+    if (device_share < HYBRID_MIN_SHARE)
+        device_share = HYBRID_MIN_SHARE;
+    if (device_share > 1 - HYBRID_MIN_SHARE)
+        device_share = 1 - HYBRID_MIN_SHARE;
+}
+
+/*
+ * The device renders rows [0, split), the CPU the interior rows
+ * [split, height - 1).
+ */
+int sinoscope_image_hybrid(sinoscope_t *ptr)
+{
+    int ret;
+    int split;
+    double cpu_time, device_time;
+
+    if (ptr == NULL)
+        return -1;
+    if (ptr->height < 3)
+        return sinoscope_image_openmp(ptr);
+
+    split = device_share * (ptr->height - 1) + 0.5f;
+    if (split < 1)
+        split = 1;
+    if (split > ptr->height - 2)
+        split = ptr->height - 2;
+
+    if (opencl_rows_submit(ptr, 0, split) < 0)
+        return -1;
+    cpu_time = now();
+    ret = sinoscope_rows_openmp(ptr, split, ptr->height - 1);
+    cpu_time = now() - cpu_time;
+    device_time = opencl_rows_wait();
+    if (ret < 0 || device_time < 0)
+        return -1;
+
+    update_share(split, device_time, ptr->height - 1 - split, cpu_time);
+    return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ * sinoscope_hybrid.h
+ *
+ * Sinoscope backend splitting each frame between OpenCL and OpenMP
+ */
+
+#ifndef SINOSCOPE_HYBRID_H_
+#define SINOSCOPE_HYBRID_H_
+
+#include "sinoscope.h"
+
+int sinoscope_image_hybrid(sinoscope_t *b_ptr);
+void hybrid_reset(void);
+float hybrid_device_share(void);
+
+#endif /* SINOSCOPE_HYBRID_H_ */
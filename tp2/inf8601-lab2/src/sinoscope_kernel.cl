@@ -17,6 +17,12 @@
 #define M_PI 3.14159265358979323846264338328
 #endif
 
+/* same values as enum sinoscope_kernel and sinoscope_taylor.h */
+#define KERNEL_DIRECT 0
+#define KERNEL_RECURRENCE 1
+#define TAYLOR_RESEED 32
+#define TAYLOR_RECURRENCE_MIN 7
+
 typedef struct sinoscope sinoscope_t;
 
 struct sinoscope {
@@ -25,6 +31,7 @@ struct sinoscope {
 	int height;
 	int interval;
 	int taylor;
+	int kernel;
 	float interval_inv;
 	float time;
 	float max;
@@ -40,50 +47,174 @@ struct rgb {
 	unsigned char b;
 };
 
-__constant struct rgb black = { .r = 0, .g = 0, .b = 0 };
-__constant struct rgb white = { .r = 255, .g = 255, .b = 255 };
+/*
+ * Color ramp of color.c as base + slope * x on each of the 5 intervals,
+ * the 6th entry being the out of scale (white) color.
+ */
+__constant int ramp_base[6][3] = {
+	{ 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 },
+	{ 255, 255, 0 }, { 255, 0, 0 }, { 255, 255, 255 },
+};
+
+__constant int ramp_slope[6][3] = {
+	{ 0, 1, 0 }, { 0, 0, -1 }, { 1, 0, 0 },
+	{ 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, 0 },
+};
 
+/* branchless value_color, the selects replace the switch of color.c */
 void value_color(struct rgb *color, float value, int interval, float interval_inv)
 {
-	#pragma OPENCL EXTENSION cl_khr_byte_addressable_store: enable
-	if (isnan(value)) {
-		*color = black;
-		return;
+	int nan = isnan(value);
+	int v = nan ? 0 : (int)value;
+	int x = ((v % interval) * 255) * interval_inv;
+	int i = v * interval_inv;
+	i = (i < 0 || i > 4) ? 5 : i;
+	color->r = nan ? 0 : ramp_base[i][0] + ramp_slope[i][0] * x;
+	color->g = nan ? 0 : ramp_base[i][1] + ramp_slope[i][1] * x;
+	color->b = nan ? 0 : ramp_base[i][2] + ramp_slope[i][2] * x;
+}
+
+float taylor_direct(float px, float py, int taylor, float time, float phase0, float phase1)
+{
+	float val = 0.0f;
+	for (int i = 1; i <= taylor; i += 2) {
+		val += sin(px * i * phase1 + time) / i + cos(py * i * phase0) / i;
 	}
+	return val;
+}
+
+/* angle-addition recurrence, see sinoscope_taylor.h for the error budget */
+float taylor_recurrence(float px, float py, int taylor, float time, float phase0, float phase1)
+{
+	float val = 0.0f;
+	float rac = cos(2 * px * phase1), ras = sin(2 * px * phase1);
+	float rbc = cos(2 * py * phase0), rbs = sin(2 * py * phase0);
+	float ss, sc, cc, cs, tmp;
+
+	for (int k = 1; k <= taylor; k += 2 * TAYLOR_RESEED) {
+		ss = sin(px * k * phase1 + time);
+		sc = cos(px * k * phase1 + time);
+		cc = cos(py * k * phase0);
+		cs = sin(py * k * phase0);
+		int last = min(k + 2 * (TAYLOR_RESEED - 1), taylor);
+		for (int j = k; j <= last; j += 2) {
+			val += (ss + cc) / j;
+			tmp = ss * rac + sc * ras;
+			sc = sc * rac - ss * ras;
+			ss = tmp;
+			tmp = cc * rbc - cs * rbs;
+			cs = cs * rbc + cc * rbs;
+			cc = tmp;
+		}
+	}
+	return val;
+}
+
+/*
+ * Four consecutive pixels of a row: px varies, py is shared, so the cos
+ * half of the series is evaluated once for the four of them.
+ */
+float4 taylor_direct4(float4 px, float py, int taylor, float time, float phase0, float phase1)
+{
+	float4 val = 0.0f;
+	for (int i = 1; i <= taylor; i += 2) {
+		val += sin(px * i * phase1 + time) / i + cos(py * i * phase0) / i;
+	}
+	return val;
+}
+
+float4 taylor_recurrence4(float4 px, float py, int taylor, float time, float phase0, float phase1)
+{
+	float4 val = 0.0f;
+	float4 rac = cos(2 * px * phase1), ras = sin(2 * px * phase1);
+	float rbc = cos(2 * py * phase0), rbs = sin(2 * py * phase0);
+	float4 ss, sc, tmp4;
+	float cc, cs, tmp;
+
+	for (int k = 1; k <= taylor; k += 2 * TAYLOR_RESEED) {
+		ss = sin(px * k * phase1 + time);
+		sc = cos(px * k * phase1 + time);
+		cc = cos(py * k * phase0);
+		cs = sin(py * k * phase0);
+		int last = min(k + 2 * (TAYLOR_RESEED - 1), taylor);
+		for (int j = k; j <= last; j += 2) {
+			val += (ss + cc) / j;
+			tmp4 = ss * rac + sc * ras;
+			sc = sc * rac - ss * ras;
+			ss = tmp4;
+			tmp = cc * rbc - cs * rbs;
+			cs = cs * rbc + cc * rbs;
+			cc = tmp;
+		}
+	}
+	return val;
+}
+
+/*
+ * Work-item (y, x) covers pixels [y * ppi, y * ppi + ppi) of row x, ppi
+ * being a multiple of 4. Dimension 0 runs along the row, so neighbouring
+ * work-items write neighbouring bpp * ppi byte blocks. bpp is 3 (RGB) or
+ * 4 (RGBA, alpha 255), see enum sinoscope_layout.
+ */
+__kernel void sinoscope_kernel_vec(__global unsigned char* output,
+							   int width,
+							   int interval,
+							   int taylor,
+							   float interval_inv,
+							   float time,
+							   float phase0,
+							   float phase1,
+							   float dx,
+							   float dy,
+							   int kernel,
+							   int height,
+							   int ppi,
+							   int bpp)
+{
 	struct rgb c;
-	int x = (((int)value % interval) * 255) * interval_inv;
-	int i = value * interval_inv;
-	switch(i) {
-	case 0:
-		c.r = 0;
-		c.g = x;
-		c.b = 255;
-		break;
-	case 1:
-		c.r = 0;
-		c.g = 255;
-		c.b = 255 - x;
-		break;
-	case 2:
-		c.r = x;
-		c.g = 255;
-		c.b = 0;
-		break;
-	case 3:
-		c.r = 255;
-		c.g = 255 - x;
-		c.b = 0;
-		break;
-	case 4:
-		c.r = 255;
-		c.g = 0;
-		c.b = x;
-		break;
-	default:
-		c = white;
-		break;
+	float v[4];
+	unsigned char pix[16];
+
+	int x = get_global_id(1);
+	int y0 = get_global_id(0) * ppi;
+	if (x >= height || y0 >= width)
+		return;
+	float py = dy * x - 2 * M_PI_F;
+	__global unsigned char *row = output + (x * bpp) * width;
+
+	#pragma OPENCL EXTENSION cl_khr_byte_addressable_store: enable
+	for (int g = 0; g < ppi; g += 4) {
+		int y = y0 + g;
+		if (y >= width)
+			break;
+		float4 px = dx * convert_float4((int4)(y) + (int4)(0, 1, 2, 3)) - 2 * M_PI_F;
+		float4 val;
+		if (kernel == KERNEL_RECURRENCE && taylor >= TAYLOR_RECURRENCE_MIN)
+			val = taylor_recurrence4(px, py, taylor, time, phase0, phase1);
+		else
+			val = taylor_direct4(px, py, taylor, time, phase0, phase1);
+		val = (atan(val) - atan(-val)) / M_PI_F;
+		val = (val + 1) * 100;
+		vstore4(val, 0, v);
+		for (int k = 0; k < 4; k++) {
+			value_color(&c, v[k], interval, interval_inv);
+			pix[bpp * k + 0] = c.r;
+			pix[bpp * k + 1] = c.g;
+			pix[bpp * k + 2] = c.b;
+			if (bpp == 4)
+				pix[bpp * k + 3] = 255;
+		}
+		if (y + 4 <= width && bpp == 4) {
+			vstore16(vload16(0, pix), 0, row + y * 4);
+		} else if (y + 4 <= width) {
+			vstore4(vload4(0, pix), 0, row + y * 3);
+			vstore4(vload4(1, pix), 0, row + y * 3 + 4);
+			vstore4(vload4(2, pix), 0, row + y * 3 + 8);
+		} else {
+			for (int k = 0; k < bpp * (width - y); k++)
+				row[y * bpp + k] = pix[k];
+		}
 	}
-	*color = c;
 }
 
 __kernel void sinoscope_kernel(__global unsigned char* output,
@@ -95,24 +226,35 @@ __kernel void sinoscope_kernel(__global unsigned char* output,
 							   float phase0,
 							   float phase1,
 							   float dx,
-							   float dy)
+							   float dy,
+							   int kernel,
+							   int height,
+							   int bpp)
 {
     struct rgb c;
 
     int x = get_global_id(1);
     int y = get_global_id(0);
+	/* the global size is rounded up to the work-group size */
+	if (x >= height || y >= width)
+		return;
 	float px = dx * y - 2 * M_PI;
 	float py = dy * x - 2 * M_PI;
-	float val = 0.0f;
-	for (int i = 1; i <= taylor; i += 2) {
-		val += sin(px * i * phase1 + time) / i + cos(py * i * phase0) / i;
-	}
+	float val;
+	if (kernel == KERNEL_RECURRENCE && taylor >= TAYLOR_RECURRENCE_MIN)
+		val = taylor_recurrence(px, py, taylor, time, phase0, phase1);
+	else
+		val = taylor_direct(px, py, taylor, time, phase0, phase1);
 	val = (atan(1.0 * val) - atan(-1.0 * val)) / (M_PI);
 	val = (val + 1) * 100;
 	value_color(&c, val, interval, interval_inv);
-	int index = (y * 3) + (x * 3) * width;
+	int index = (y + x * width) * bpp;
 
 	#pragma OPENCL EXTENSION cl_khr_byte_addressable_store: enable
+	if (bpp == 4) {
+		vstore4((uchar4)(c.r, c.g, c.b, 255), 0, output + index);
+		return;
+	}
 	output[index + 0] = c.r;
 	output[index + 1] = c.g;
 	output[index + 2] = c.b;
@@ -6,6 +6,10 @@
  */
 
 #include <iostream>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 extern "C" {
 #include <stdlib.h>
@@ -29,18 +33,170 @@ static cl_command_queue queue = NULL;
 static cl_context context = NULL;
 static cl_program prog = NULL;
 static cl_kernel kernel = NULL;
+static cl_kernel kernel_vec = NULL;
 
 static cl_mem output = NULL;
+static cl_device_id device = NULL;
+
+/*
+ * Pipelined mode: each slot owns a device output buffer and a pinned
+ * staging buffer (CL_MEM_ALLOC_HOST_PTR) that stays mapped for the whole
+ * run. The kernel runs on the compute queue and the readback of the slot
+ * on a second queue, so the copy of frame k overlaps the kernel of frame
+ * k + 1.
+ */
+struct pipeline_slot {
+    cl_mem output;
+    cl_mem pinned;
+    unsigned char *host;
+    cl_event ready;
+};
+
+static cl_command_queue xfer_queue = NULL;
+static struct pipeline_slot ring[PIPELINE_MAX_DEPTH];
+static int ring_depth = 0;
+static int ring_head = 0;       /* next slot to submit */
+static int ring_tail = 0;       /* oldest slot in flight */
+static int ring_used = 0;
+static size_t ring_size = 0;
+static int static_args_set = 0;
+
+/* rows in flight for the hybrid backend, see opencl_rows_submit() */
+static cl_event rows_start = NULL;
+static cl_event rows_done = NULL;
+static double rows_submitted = 0;
+
+/*
+ * Launch configuration: pixels per work-item (1 runs sinoscope_kernel,
+ * 4 or 8 sinoscope_kernel_vec) and work-group size ({0, 0} lets the
+ * driver choose). Picked by tune_launch() on the first frame.
+ */
+struct launch_config {
+    int ppi;
+    size_t local[2];
+};
+
+#define TUNE_FRAMES 3
+
+static const struct launch_config default_launch = { 1, { 0, 0 } };
+static struct launch_config launch = default_launch;
+static int tuned = 0;
+/* device and kernel source, the key of both caches */
+static uint64_t program_hash = 0;
+
+static const int tune_ppi[] = { 1, 4, 8 };
+static const size_t tune_local[][2] = {
+    { 0, 0 }, { 16, 1 }, { 32, 1 }, { 64, 1 }, { 128, 1 }, { 256, 1 },
+    { 8, 8 }, { 16, 4 }, { 32, 4 }, { 16, 16 },
+};
+
+#define BUILD_OPTIONS "-cl-fast-relaxed-math"
+#define CACHE_ENV "SINOSCOPE_CL_CACHE"
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static const char *device_spec = NULL;
+
+static const struct device_type_def {
+    const char *name;
+    cl_device_type type;
+} device_types[] = {
+    { "gpu", CL_DEVICE_TYPE_GPU },
+    { "cpu", CL_DEVICE_TYPE_CPU },
+    { "accel", CL_DEVICE_TYPE_ACCELERATOR },
+    { "all", CL_DEVICE_TYPE_ALL },
+    { NULL, 0 },
+};
+
+void opencl_set_device(const char *spec)
+{
+    device_spec = spec;
+}
+
+/*
+ * Return the index-th device of the given type whose name contains
+ * pattern (any name if NULL), counting across all platforms.
+ */
+static int find_device(cl_platform_id *platforms, cl_uint num_platforms,
+        cl_device_type type, const char *pattern, int index, cl_device_id *found)
+{
+    cl_int ret;
+    cl_uint i, j, num_dev;
+    cl_device_id *ids = NULL;
+    char name[BUF_SIZE];
+
+    for (i = 0; i < num_platforms; i++) {
+        ret = clGetDeviceIDs(platforms[i], type, 0, NULL, &num_dev);
+        if (ret != CL_SUCCESS || num_dev == 0)
+            continue;
+        ids = (cl_device_id *) malloc(num_dev * sizeof(cl_device_id));
+        ERR_NOMEM(ids);
+        ret = clGetDeviceIDs(platforms[i], type, num_dev, ids, NULL);
+        ERR_THROW(CL_SUCCESS, ret, "failed to get device ids");
+        for (j = 0; j < num_dev; j++) {
+            if (pattern != NULL) {
+                ret = clGetDeviceInfo(ids[j], CL_DEVICE_NAME, BUF_SIZE, name, NULL);
+                ERR_THROW(CL_SUCCESS, ret, "failed to get device info");
+                if (strstr(name, pattern) == NULL)
+                    continue;
+            }
+            if (index-- == 0) {
+                *found = ids[j];
+                FREE(ids);
+                return 0;
+            }
+        }
+        FREE(ids);
+    }
+    return -1;
+error:
+    FREE(ids);
+    return -1;
+}
+
+/*
+ * Device spec: "<type>[:<index>]" where type is one of device_types[],
+ * or a device name substring, optionally followed by ":<index>". Without
+ * a spec, the first GPU is used, then the first CPU device (e.g. PoCL).
+ */
+static int select_device(cl_platform_id *platforms, cl_uint num_platforms, cl_device_id *found)
+{
+    char spec[BUF_SIZE];
+    char *sep;
+    const char *pattern;
+    cl_device_type type = CL_DEVICE_TYPE_ALL;
+    int index = 0;
+    int i;
+
+    if (device_spec == NULL) {
+        if (find_device(platforms, num_platforms, CL_DEVICE_TYPE_GPU, NULL, 0, found) == 0)
+            return 0;
+        return find_device(platforms, num_platforms, CL_DEVICE_TYPE_CPU, NULL, 0, found);
+    }
+
+    snprintf(spec, BUF_SIZE, "%s", device_spec);
+    sep = strrchr(spec, ':');
+    if (sep != NULL && sep[1] != '\0' && strspn(sep + 1, "0123456789") == strlen(sep + 1)) {
+        *sep = '\0';
+        index = atoi(sep + 1);
+    }
+    pattern = spec;
+    for (i = 0; device_types[i].name != NULL; i++) {
+        if (strcmp(spec, device_types[i].name) == 0) {
+            type = device_types[i].type;
+            pattern = NULL;
+            break;
+        }
+    }
+    return find_device(platforms, num_platforms, type, pattern, index, found);
+}
 
 int get_opencl_queue()
 {
-    cl_int ret, i;
-    cl_uint num_dev;
-    cl_device_id device;
+    cl_int ret;
     cl_platform_id *platform_ids = NULL;
     cl_uint num_platforms;
     cl_uint info;
-    char vendor[BUF_SIZE];
     char name[BUF_SIZE];
 
     ret = clGetPlatformIDs(0, NULL, &num_platforms);
@@ -53,18 +209,12 @@ int get_opencl_queue()
     ret = clGetPlatformIDs(num_platforms, platform_ids, NULL);
     ERR_THROW(CL_SUCCESS, ret, "failed to get plateform ids");
 
-    for (i = 0; i < num_platforms; i++) {
-        ret = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_VENDOR, BUF_SIZE, vendor, NULL);
-        ERR_THROW(CL_SUCCESS, ret, "failed to get plateform info");
-        ret = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_NAME, BUF_SIZE, name, NULL);
-        ERR_THROW(CL_SUCCESS, ret, "failed to get plateform info");
-        cout << vendor << " " << name << "\n";
-        ret = clGetDeviceIDs(platform_ids[i], CL_DEVICE_TYPE_GPU, 1, &device, &num_dev);
-        if (CL_SUCCESS == ret) {
-            break;
-        }
-    }
-    ERR_THROW(CL_SUCCESS, ret, "failed to find a device\n");
+    ret = select_device(platform_ids, num_platforms, &device);
+    ERR_THROW(0, ret, "failed to find a device\n");
+
+    ret = clGetDeviceInfo(device, CL_DEVICE_NAME, BUF_SIZE, name, NULL);
+    ERR_THROW(CL_SUCCESS, ret, "failed to get device info");
+    cout << name << "\n";
 
     ret = clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &info, NULL);
     ERR_THROW(CL_SUCCESS, ret, "failed to get device info");
@@ -77,7 +227,8 @@ int get_opencl_queue()
     context = clCreateContext(0, 1, &device, NULL, NULL, &ret);
     ERR_THROW(CL_SUCCESS, ret, "failed to create context");
 
-    queue = clCreateCommandQueue(context, device, 0, &ret);
+    /* profiling gives the device time of the hybrid backend's rows */
+    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &ret);
     ERR_THROW(CL_SUCCESS, ret, "failed to create queue");
 
     ret = 0;
@@ -125,10 +276,145 @@ error:
     goto done;
 }
 
-int create_buffer(int width, int height)
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Program binaries and tuning results are cached in $SINOSCOPE_CL_CACHE
+ * (default ~/.cache/sinoscope, empty to disable), one file per hash.
+ */
+static char *cache_path(uint64_t hash, const char *ext)
+{
+    const char *dir = getenv(CACHE_ENV);
+    const char *home;
+    char *path = NULL;
+    char *file = NULL;
+
+    if (dir == NULL) {
+        home = getenv("HOME");
+        if (home == NULL)
+            return NULL;
+        if (asprintf(&path, "%s/.cache", home) < 0)
+            return NULL;
+        mkdir(path, 0755);
+        FREE(path);
+        if (asprintf(&path, "%s/.cache/sinoscope", home) < 0)
+            return NULL;
+        mkdir(path, 0755);
+        dir = path;
+    } else if (dir[0] == '\0') {
+        return NULL;
+    } else {
+        mkdir(dir, 0755);
+    }
+
+    if (asprintf(&file, "%s/%016llx.%s", dir, (unsigned long long) hash, ext) < 0)
+        file = NULL;
+    FREE(path);
+    return file;
+}
+
+/* hash of the device, driver and build options */
+static uint64_t device_hash()
+{
+    static const cl_device_info keys[] = { CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION };
+    char info[BUF_SIZE];
+    uint64_t hash = FNV_OFFSET;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (clGetDeviceInfo(device, keys[i], BUF_SIZE, info, NULL) != CL_SUCCESS)
+            info[0] = '\0';
+        hash = fnv1a(hash, info, strlen(info) + 1);
+    }
+    return fnv1a(hash, BUILD_OPTIONS, sizeof(BUILD_OPTIONS));
+}
+
+static cl_program load_cached_program(const char *path)
+{
+    cl_int err, status;
+    cl_program p = NULL;
+    unsigned char *binary = NULL;
+    size_t size = 0;
+    long end;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) < 0 || (end = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET) < 0)
+        goto done;
+    size = end;
+    binary = (unsigned char *) malloc(size);
+    if (binary == NULL || fread(binary, 1, size, f) != size)
+        goto done;
+
+    p = clCreateProgramWithBinary(context, 1, &device, &size,
+            (const unsigned char **) &binary, &status, &err);
+    if (err != CL_SUCCESS || status != CL_SUCCESS)
+        goto stale;
+    err = clBuildProgram(p, 1, &device, BUILD_OPTIONS, NULL, NULL);
+    if (err != CL_SUCCESS)
+        goto stale;
+done:
+    FREE(binary);
+    fclose(f);
+    return p;
+stale:
+    if (p != NULL)
+        clReleaseProgram(p);
+    p = NULL;
+    goto done;
+}
+
+static void save_program_binary(const char *path, cl_program p)
+{
+    size_t size = 0;
+    unsigned char *binary = NULL;
+    char *tmp = NULL;
+    FILE *f = NULL;
+
+    if (clGetProgramInfo(p, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0)
+        return;
+    binary = (unsigned char *) malloc(size);
+    if (binary == NULL)
+        return;
+    if (clGetProgramInfo(p, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS)
+        goto done;
+    /* write aside and rename, concurrent runs never see a partial file */
+    if (asprintf(&tmp, "%s.%d", path, (int) getpid()) < 0) {
+        tmp = NULL;
+        goto done;
+    }
+    f = fopen(tmp, "wb");
+    if (f == NULL)
+        goto done;
+    if (fwrite(binary, 1, size, f) != size) {
+        fclose(f);
+        unlink(tmp);
+        goto done;
+    }
+    fclose(f);
+    if (rename(tmp, path) < 0)
+        unlink(tmp);
+done:
+    FREE(tmp);
+    FREE(binary);
+}
+
+int create_buffer(int width, int height, int bpp)
 {
     cl_int ret = 0;
-    output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 3 * width * height, NULL, &ret);
+    output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, (size_t) bpp * width * height, NULL, &ret);
 done:
     return ret;
 error:
@@ -136,12 +422,16 @@ error:
     goto done;
 }
 
-int opencl_init(int width, int height)
+int opencl_init(int width, int height, int bpp)
 {
     cl_int err;
     char *code = NULL;
+    char *binary_path = NULL;
     size_t length = 0;
 
+    static_args_set = 0;
+    launch = default_launch;
+    tuned = 0;
     get_opencl_queue();
     if (queue == NULL)
         return -1;
@@ -152,61 +442,217 @@ int opencl_init(int width, int height)
     /*
      * Initialisation du programme
      */
-    prog = clCreateProgramWithSource(context, 1, (const char **) &code, &length, &err);
-    ERR_THROW(CL_SUCCESS, err, "clCreateProgramWithSource failed");
-    err = clBuildProgram(prog, 0, NULL, "-cl-fast-relaxed-math", NULL, NULL);
-    ERR_THROW(CL_SUCCESS, err, "clBuildProgram failed");
+    program_hash = fnv1a(device_hash(), code, length);
+    binary_path = cache_path(program_hash, "bin");
+    if (binary_path != NULL)
+        prog = load_cached_program(binary_path);
+    if (prog == NULL) {
+        prog = clCreateProgramWithSource(context, 1, (const char **) &code, &length, &err);
+        ERR_THROW(CL_SUCCESS, err, "clCreateProgramWithSource failed");
+        err = clBuildProgram(prog, 0, NULL, BUILD_OPTIONS, NULL, NULL);
+        ERR_THROW(CL_SUCCESS, err, "clBuildProgram failed");
+        if (binary_path != NULL)
+            save_program_binary(binary_path, prog);
+    }
     kernel = clCreateKernel(prog, "sinoscope_kernel", &err);
     ERR_THROW(CL_SUCCESS, err, "clCreateKernel failed");
-    err = create_buffer(width, height);
+    kernel_vec = clCreateKernel(prog, "sinoscope_kernel_vec", &err);
+    ERR_THROW(CL_SUCCESS, err, "clCreateKernel failed");
+    err = create_buffer(width, height, bpp);
     ERR_THROW(CL_SUCCESS, err, "create_buffer failed");
 
     free(code);
+    FREE(binary_path);
     return 0;
 error:
+    FREE(code);
+    FREE(binary_path);
     return -1;
 }
 
 
 void opencl_shutdown()
 {
-    if (queue) 	clReleaseCommandQueue(queue);
-    if (context)	clReleaseContext(context); 
-    if (output) clReleaseMemObject(output);
+    opencl_rows_wait();
+    opencl_pipeline_shutdown();
     if (kernel) clReleaseKernel(kernel);
+    if (kernel_vec) clReleaseKernel(kernel_vec);
+    if (prog) clReleaseProgram(prog);
+    if (output) clReleaseMemObject(output);
+    if (queue) clReleaseCommandQueue(queue);
+    if (context) clReleaseContext(context);
+    kernel = NULL;
+    kernel_vec = NULL;
+    prog = NULL;
+    output = NULL;
+    queue = NULL;
+    context = NULL;
+    device = NULL;
 }
 
-int sinoscope_image_opencl(sinoscope_t *ptr)
+static cl_int set_kernel_args(cl_kernel k, int bit, sinoscope_t *ptr, cl_mem out)
 {
-    cl_int ret = 0;
-    cl_event ev;
-    size_t work_dim[2] = {(size_t) ptr->width, (size_t) ptr->height};
-
-    ret =
-        clSetKernelArg(kernel, 0, sizeof(cl_mem), &output) |
-        clSetKernelArg(kernel, 1, sizeof(int), &(ptr->width)) |
-        clSetKernelArg(kernel, 2, sizeof(int), &(ptr->interval)) |
-        clSetKernelArg(kernel, 3, sizeof(int), &(ptr->taylor)) |
-        clSetKernelArg(kernel, 4, sizeof(float), &(ptr->interval_inv)) |
-        clSetKernelArg(kernel, 5, sizeof(float), &(ptr->time)) |
-        clSetKernelArg(kernel, 6, sizeof(float), &(ptr->phase0)) |
-        clSetKernelArg(kernel, 7, sizeof(float), &(ptr->phase1)) |
-        clSetKernelArg(kernel, 8, sizeof(float), &(ptr->dx)) |
-        clSetKernelArg(kernel, 9, sizeof(float), &(ptr->dy));
-
-    ERR_THROW(CL_SUCCESS, ret, "clSetKernelArg failed");
-
-    ret = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, work_dim, NULL, 0, NULL, &ev);
-    ERR_THROW(CL_SUCCESS, ret, "clEnqueueNDRangeKernel failed");
+    cl_int ret = CL_SUCCESS;
+
+    /* only time and phases change from one frame to the next */
+    if (!(static_args_set & bit)) {
+        ret =
+            clSetKernelArg(k, 1, sizeof(int), &(ptr->width)) |
+            clSetKernelArg(k, 2, sizeof(int), &(ptr->interval)) |
+            clSetKernelArg(k, 3, sizeof(int), &(ptr->taylor)) |
+            clSetKernelArg(k, 4, sizeof(float), &(ptr->interval_inv)) |
+            clSetKernelArg(k, 8, sizeof(float), &(ptr->dx)) |
+            clSetKernelArg(k, 9, sizeof(float), &(ptr->dy)) |
+            clSetKernelArg(k, 10, sizeof(int), &(ptr->kernel)) |
+            clSetKernelArg(k, 11, sizeof(int), &(ptr->height));
+        if (ret == CL_SUCCESS)
+            static_args_set |= bit;
+    }
+    ret |=
+        clSetKernelArg(k, 0, sizeof(cl_mem), &out) |
+        clSetKernelArg(k, 5, sizeof(float), &(ptr->time)) |
+        clSetKernelArg(k, 6, sizeof(float), &(ptr->phase0)) |
+        clSetKernelArg(k, 7, sizeof(float), &(ptr->phase1));
+    return ret;
+}
+
+/* rows [first, first + count) of the frame, at their place in out */
+static cl_int enqueue_rows(sinoscope_t *ptr, cl_mem out, const struct launch_config *cfg,
+        int first, int count, cl_event *ev)
+{
+    cl_int ret;
+    cl_kernel k;
+    size_t global[2];
+    size_t offset[2] = { 0, (size_t) first };
+    int i;
+
+    global[0] = (ptr->width + cfg->ppi - 1) / cfg->ppi;
+    global[1] = count;
+    if (cfg->local[0] != 0) {
+        for (i = 0; i < 2; i++)
+            global[i] = (global[i] + cfg->local[i] - 1) / cfg->local[i] * cfg->local[i];
+    }
+    if (cfg->ppi > 1) {
+        k = kernel_vec;
+        ret = set_kernel_args(k, 2, ptr, out) |
+            clSetKernelArg(k, 12, sizeof(int), &cfg->ppi) |
+            clSetKernelArg(k, 13, sizeof(int), &ptr->bpp);
+    } else {
+        k = kernel;
+        ret = set_kernel_args(k, 1, ptr, out) | clSetKernelArg(k, 12, sizeof(int), &ptr->bpp);
+    }
+    if (ret != CL_SUCCESS)
+        return ret;
+    return clEnqueueNDRangeKernel(queue, k, 2, first != 0 ? offset : NULL, global,
+            cfg->local[0] != 0 ? cfg->local : NULL, 0, NULL, ev);
+}
 
-    ret = clFinish(queue);
-    ERR_THROW(CL_SUCCESS, ret, "clFinish failed");
+static cl_int enqueue_frame(sinoscope_t *ptr, cl_mem out, const struct launch_config *cfg, cl_event *ev)
+{
+    return enqueue_rows(ptr, out, cfg, 0, ptr->height, ev);
+}
 
-    ret = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, ptr->buf_size, ptr->buf, 0, NULL, &ev);
-    ERR_THROW(CL_SUCCESS, ret, "clEnqueueReadBuffer failed");
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* time TUNE_FRAMES frames after a warm-up one, negative if cfg fails */
+static double time_launch(sinoscope_t *ptr, const struct launch_config *cfg)
+{
+    double start;
+    int i;
+
+    if (enqueue_frame(ptr, output, cfg, NULL) != CL_SUCCESS || clFinish(queue) != CL_SUCCESS)
+        return -1;
+    start = now();
+    for (i = 0; i < TUNE_FRAMES; i++) {
+        if (enqueue_frame(ptr, output, cfg, NULL) != CL_SUCCESS)
+            return -1;
+    }
+    if (clFinish(queue) != CL_SUCCESS)
+        return -1;
+    return now() - start;
+}
+
+/*
+ * Pick the fastest launch configuration for this device and frame, and
+ * remember it in the cache directory so later runs skip the search.
+ */
+static void tune_launch(sinoscope_t *ptr)
+{
+    struct launch_config cfg, best = default_launch;
+    double t, best_time = -1;
+    size_t max_wg;
+    uint64_t hash;
+    char *path;
+    FILE *f;
+    unsigned int i, j;
+
+    tuned = 1;
+    hash = fnv1a(program_hash, &ptr->width, sizeof(ptr->width));
+    hash = fnv1a(hash, &ptr->height, sizeof(ptr->height));
+    hash = fnv1a(hash, &ptr->taylor, sizeof(ptr->taylor));
+    hash = fnv1a(hash, &ptr->kernel, sizeof(ptr->kernel));
+    hash = fnv1a(hash, &ptr->bpp, sizeof(ptr->bpp));
+    path = cache_path(hash, "tune");
+
+    if (path != NULL && (f = fopen(path, "r")) != NULL) {
+        if (fscanf(f, "%d %zu %zu", &cfg.ppi, &cfg.local[0], &cfg.local[1]) == 3 &&
+                time_launch(ptr, &cfg) >= 0) {
+            launch = cfg;
+            fclose(f);
+            goto done;
+        }
+        fclose(f);
+    }
+
+    for (i = 0; i < sizeof(tune_ppi) / sizeof(tune_ppi[0]); i++) {
+        cfg.ppi = tune_ppi[i];
+        if (clGetKernelWorkGroupInfo(cfg.ppi > 1 ? kernel_vec : kernel, device,
+                CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_wg), &max_wg, NULL) != CL_SUCCESS)
+            continue;
+        for (j = 0; j < sizeof(tune_local) / sizeof(tune_local[0]); j++) {
+            cfg.local[0] = tune_local[j][0];
+            cfg.local[1] = tune_local[j][1];
+            if (cfg.local[0] * cfg.local[1] > max_wg)
+                continue;
+            t = time_launch(ptr, &cfg);
+            if (t >= 0 && (best_time < 0 || t < best_time)) {
+                best = cfg;
+                best_time = t;
+            }
+        }
+    }
+    launch = best;
+
+    if (path != NULL && (f = fopen(path, "w")) != NULL) {
+        fprintf(f, "%d %zu %zu\n", launch.ppi, launch.local[0], launch.local[1]);
+        fclose(f);
+    }
+done:
+    cout << "launch " << launch.ppi << " pixels per item, work-group "
+         << launch.local[0] << "x" << launch.local[1] << "\n";
+    FREE(path);
+}
+
+int sinoscope_image_opencl(sinoscope_t *ptr)
+{
+    cl_int ret = 0;
 
     if (ptr == NULL)
         goto error;
+    if (!tuned)
+        tune_launch(ptr);
+
+    ret = enqueue_frame(ptr, output, &launch, NULL);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueNDRangeKernel failed");
+
+    /* the queue is in order, the blocking read waits for the kernel */
+    ret = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, ptr->buf_size, ptr->buf, 0, NULL, NULL);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueReadBuffer failed");
 
 done:
     return ret;
@@ -214,3 +660,198 @@ error:
     ret = -1;
     goto done;
 }
+
+int opencl_rows_submit(sinoscope_t *ptr, int first, int count)
+{
+    cl_int ret = 0;
+    size_t row_size;
+
+    ERR_ASSERT(rows_done == NULL, "rows already in flight");
+    ERR_ASSERT(first >= 0 && count > 0 && first + count <= ptr->height, "invalid rows");
+    if (!tuned)
+        tune_launch(ptr);
+
+    rows_submitted = now();
+    ret = enqueue_rows(ptr, output, &launch, first, count, &rows_start);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueNDRangeKernel failed");
+
+    row_size = (size_t) ptr->width * ptr->bpp;
+    ret = clEnqueueReadBuffer(queue, output, CL_FALSE, first * row_size, count * row_size,
+            ptr->buf + first * row_size, 0, NULL, &rows_done);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueReadBuffer failed");
+    ret = clFlush(queue);
+    ERR_THROW(CL_SUCCESS, ret, "clFlush failed");
+    return 0;
+error:
+    opencl_rows_wait();
+    return -1;
+}
+
+double opencl_rows_wait()
+{
+    cl_int ret = CL_SUCCESS;
+    cl_ulong start, end;
+    double t = -1;
+
+    if (rows_done != NULL) {
+        ret = clWaitForEvents(1, &rows_done);
+        t = now() - rows_submitted;
+        /* without profiling, the host time includes the wait for the CPU rows */
+        if (ret == CL_SUCCESS && rows_start != NULL &&
+                clGetEventProfilingInfo(rows_start, CL_PROFILING_COMMAND_START,
+                        sizeof(start), &start, NULL) == CL_SUCCESS &&
+                clGetEventProfilingInfo(rows_done, CL_PROFILING_COMMAND_END,
+                        sizeof(end), &end, NULL) == CL_SUCCESS && end > start)
+            t = (end - start) * 1e-9;
+    } else if (rows_start != NULL) {
+        ret = clFinish(queue);
+    }
+    if (rows_start) clReleaseEvent(rows_start);
+    if (rows_done) clReleaseEvent(rows_done);
+    rows_start = NULL;
+    rows_done = NULL;
+    return ret == CL_SUCCESS ? t : -1;
+}
+
+int opencl_pipeline_init(int width, int height, int bpp, int depth)
+{
+    cl_int ret = 0;
+    int i;
+
+    ERR_ASSERT(context != NULL, "opencl_init must be called first");
+    ERR_ASSERT(depth > 0 && depth <= PIPELINE_MAX_DEPTH, "invalid pipeline depth");
+
+    xfer_queue = clCreateCommandQueue(context, device, 0, &ret);
+    ERR_THROW(CL_SUCCESS, ret, "failed to create transfer queue");
+
+    ring_size = (size_t) bpp * width * height;
+    ring_depth = depth;
+    ring_head = ring_tail = ring_used = 0;
+    for (i = 0; i < depth; i++) {
+        ring[i].output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, ring_size, NULL, &ret);
+        ERR_THROW(CL_SUCCESS, ret, "failed to create output buffer");
+        ring[i].pinned = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, ring_size, NULL, &ret);
+        ERR_THROW(CL_SUCCESS, ret, "failed to create pinned buffer");
+        ring[i].host = (unsigned char *) clEnqueueMapBuffer(xfer_queue, ring[i].pinned, CL_TRUE,
+                CL_MAP_READ | CL_MAP_WRITE, 0, ring_size, 0, NULL, NULL, &ret);
+        ERR_THROW(CL_SUCCESS, ret, "failed to map pinned buffer");
+    }
+    return 0;
+error:
+    opencl_pipeline_shutdown();
+    return -1;
+}
+
+void opencl_pipeline_shutdown()
+{
+    int i;
+
+    if (xfer_queue)
+        clFinish(xfer_queue);
+    for (i = 0; i < PIPELINE_MAX_DEPTH; i++) {
+        if (ring[i].ready) clReleaseEvent(ring[i].ready);
+        if (ring[i].host) clEnqueueUnmapMemObject(xfer_queue, ring[i].pinned, ring[i].host, 0, NULL, NULL);
+        if (xfer_queue) clFinish(xfer_queue);
+        if (ring[i].pinned) clReleaseMemObject(ring[i].pinned);
+        if (ring[i].output) clReleaseMemObject(ring[i].output);
+        memset(&ring[i], 0, sizeof(ring[i]));
+    }
+    if (xfer_queue) clReleaseCommandQueue(xfer_queue);
+    xfer_queue = NULL;
+    ring_depth = ring_head = ring_tail = ring_used = 0;
+    static_args_set = 0;
+}
+
+int opencl_pipeline_submit(sinoscope_t *ptr)
+{
+    cl_int ret = 0;
+    cl_event done_ev = NULL;
+    struct pipeline_slot *slot;
+
+    ERR_ASSERT(ring_depth > 0, "pipeline not initialized");
+    ERR_ASSERT(ring_used < ring_depth, "pipeline full");
+    ERR_ASSERT((size_t) ptr->buf_size == ring_size, "frame size mismatch");
+    slot = &ring[ring_head];
+    if (!tuned)
+        tune_launch(ptr);
+
+    ret = enqueue_frame(ptr, slot->output, &launch, &done_ev);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueNDRangeKernel failed");
+
+    ret = clEnqueueReadBuffer(xfer_queue, slot->output, CL_FALSE, 0, ring_size, slot->host,
+            1, &done_ev, &slot->ready);
+    ERR_THROW(CL_SUCCESS, ret, "clEnqueueReadBuffer failed");
+    clReleaseEvent(done_ev);
+    done_ev = NULL;
+
+    /* start both queues without waiting */
+    ret = clFlush(queue) | clFlush(xfer_queue);
+    ERR_THROW(CL_SUCCESS, ret, "clFlush failed");
+
+    ring_head = (ring_head + 1) % ring_depth;
+    ring_used++;
+    return 0;
+error:
+    if (done_ev)
+        clReleaseEvent(done_ev);
+    return -1;
+}
+
+unsigned char *opencl_pipeline_next()
+{
+    cl_int ret;
+    struct pipeline_slot *slot;
+
+    if (ring_used == 0)
+        return NULL;
+    slot = &ring[ring_tail];
+    ret = clWaitForEvents(1, &slot->ready);
+    clReleaseEvent(slot->ready);
+    slot->ready = NULL;
+    ring_tail = (ring_tail + 1) % ring_depth;
+    ring_used--;
+    if (ret != CL_SUCCESS) {
+        fprintf(stderr, "%s:%d readback failed %d\n", __FILE__, __LINE__, ret);
+        return NULL;
+    }
+    return slot->host;
+}
+
+int opencl_pipeline_pending()
+{
+    return ring_used;
+}
+
+int sinoscope_image_opencl_pipeline(sinoscope_t *ptr)
+{
+    unsigned char *frame;
+
+    if (ptr == NULL)
+        return -1;
+    if (opencl_pipeline_submit(ptr) < 0)
+        return -1;
+    /* keep depth - 1 frames in flight, hand back the oldest one */
+    if (ring_used < ring_depth)
+        return 0;
+    frame = opencl_pipeline_next();
+    if (frame == NULL)
+        return -1;
+    memcpy(ptr->buf, frame, ring_size);
+    return 0;
+}
+
+int sinoscope_flush_opencl_pipeline(sinoscope_t *ptr)
+{
+    unsigned char *frame = NULL;
+
+    if (ptr == NULL)
+        return -1;
+    while (ring_used > 0) {
+        frame = opencl_pipeline_next();
+        if (frame == NULL)
+            return -1;
+    }
+    if (frame != NULL)
+        memcpy(ptr->buf, frame, ring_size);
+    return 0;
+}
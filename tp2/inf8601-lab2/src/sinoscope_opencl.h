@@ -12,10 +12,42 @@
 extern "C" {
 #endif
 
+#define PIPELINE_MAX_DEPTH 8
+
 int sinoscope_image_opencl(sinoscope_t *ptr);
-int opencl_init(int width, int height);
+int opencl_init(int width, int height, int bpp);
 void opencl_shutdown();
 
+/*
+ * Select the device used by the next opencl_init(): "gpu", "cpu", "accel"
+ * or "all", or a substring of the device name, with an optional ":<index>"
+ * suffix. NULL picks the first GPU, then the first CPU device.
+ */
+void opencl_set_device(const char *spec);
+
+/*
+ * Rows [first, first + count) of the frame: the kernel and the readback
+ * into ptr->buf are queued and opencl_rows_submit() returns at once.
+ * opencl_rows_wait() waits for them and returns the device time in
+ * seconds, or -1 on error.
+ */
+int opencl_rows_submit(sinoscope_t *ptr, int first, int count);
+double opencl_rows_wait();
+
+/*
+ * Pipelined mode: up to depth frames in flight, read back asynchronously
+ * into pinned host memory. opencl_pipeline_next() waits for the oldest
+ * frame and returns its pixels, which stay valid until the next call to
+ * opencl_pipeline_submit().
+ */
+int opencl_pipeline_init(int width, int height, int bpp, int depth);
+void opencl_pipeline_shutdown();
+int opencl_pipeline_submit(sinoscope_t *ptr);
+unsigned char *opencl_pipeline_next();
+int opencl_pipeline_pending();
+int sinoscope_image_opencl_pipeline(sinoscope_t *ptr);
+int sinoscope_flush_opencl_pipeline(sinoscope_t *ptr);
+
 #ifdef __cplusplus
 }
 #endif
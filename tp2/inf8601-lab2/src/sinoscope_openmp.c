@@ -12,46 +12,60 @@
 #include "sinoscope.h"
 #include "color.h"
 #include "util.h"
+#include "sinoscope_taylor.h"
 
-int sinoscope_image_openmp(sinoscope_t *ptr)
+/*
+ * One parallel region for rows [first, last) of the frame, all the
+ * interior rows except for the hybrid backend. The work is split by rows
+ * (x), each row being a contiguous tile of the buffer written by the inner
+ * loop. The schedule and the number of rows per chunk are taken from the
+ * runtime (--schedule and --chunk).
+ *
+ * collapse(2) over x and y was measured ~25% slower on one thread: the
+ * linearized index has to be split back at every iteration and py can no
+ * longer be hoisted out of the inner loop.
+ *
+ * precision is a constant in every call, one specialized copy each.
+ */
+static inline int rows_openmp(sinoscope_t *ptr, int first, int last, const int precision)
 {
-    if (ptr == NULL)
-        return -1;
-
     sinoscope_t sino = *ptr;
-    int x, y, index, taylor;
-    struct rgb c;
-    float val, px, py;
+    int x, y;
+    int ret = 0;
+    float *row;
     unsigned char *buffer = sino.buf;
-    float dx = sino.dx;
-    float dy = sino.dy;
     int width = sino.width;
-    int height = sino.height;
-    int t_limit = sino.taylor;
-    float phase0 = sino.phase0;
-    float phase1 = sino.phase1;
-    float t = sino.time;
-    float interval = sino.interval;
-    float interval_inv = sino.interval_inv;
 
-    for (x = 1; x < width - 1; x++)
-        #pragma omp parallel for private(px, py, c, val, taylor, index)
-        for (y = 1; y < height - 1; y++)
-        {
-            px = dx * y - 2 * M_PI;
-            py = dy * x - 2 * M_PI;
-            val = 0.0f;
+    #pragma omp parallel private(x, y, row) reduction(|:ret)
+    {
+        row = malloc(width * sizeof(float));
+        if (row == NULL)
+            ret = -1;
+        #pragma omp for schedule(runtime)
+        for (x = first; x < last; x++) {
+            if (row == NULL)
+                continue;
+            for (y = 1; y < width - 1; y++)
+                row[y] = pixel_value(x, y, &sino, precision);
+            value_color_pixels(sino.lut, &row[1], &buffer[(1 + x * width) * sino.bpp], sino.bpp, width - 2);
+        }
+        free(row);
+    }
+    return ret;
+}
 
-            for (taylor = 1; taylor <= t_limit; taylor += 2)
-                val += sin(px * taylor * phase1 + t) / taylor + cos(py * taylor * phase0) / taylor;
+int sinoscope_rows_openmp(sinoscope_t *ptr, int first, int last)
+{
+    if (ptr == NULL)
+        return -1;
+    if (ptr->precision == PRECISION_FLOAT)
+        return rows_openmp(ptr, first, last, PRECISION_FLOAT);
+    return rows_openmp(ptr, first, last, PRECISION_DOUBLE);
+}
 
-            val = (atan(1.0 * val) - atan(-1.0 * val)) / (M_PI);
-            val = (val + 1) * 100;
-            value_color(&c, val, interval, interval_inv);
-            index = (y * 3) + (x * 3) * width;
-            buffer[index + 0] = c.r;
-            buffer[index + 1] = c.g;
-            buffer[index + 2] = c.b;
-        }
-    return 0;
+int sinoscope_image_openmp(sinoscope_t *ptr)
+{
+    if (ptr == NULL)
+        return -1;
+    return sinoscope_rows_openmp(ptr, 1, ptr->height - 1);
 }
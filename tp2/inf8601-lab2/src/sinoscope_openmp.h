@@ -9,5 +9,6 @@
 #define SINOSCOPE_OPENMP_H_
 
 int sinoscope_image_openmp(sinoscope_t *b_ptr);
+int sinoscope_rows_openmp(sinoscope_t *b_ptr, int first, int last);
 
 #endif /* SINOSCOPE_OPENMP_H_ */
@@ -0,0 +1,118 @@
+/*
+ * sinoscope_separable.c
+ *
+ * The sin term of the series only depends on the column (through px) and
+ * the cos term only on the row (through py), so
+ *
+ *   val(x, y) = S(y) + C(x)
+ *
+ * where S and C are evaluated once per column and once per row. A frame
+ * costs O((W + H) * T + W * H) instead of O(W * H * T). S and C live in
+ * the series_halves of the sinoscope, so frames do not allocate them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "sinoscope.h"
+#include "sinoscope_separable.h"
+#include "sinoscope_taylor.h"
+#include "color.h"
+#include "memory.h"
+
+void free_series_halves(struct series_halves *halves)
+{
+    if (halves == NULL)
+        return;
+    FREE(halves->sin_sum);
+    FREE(halves->cos_sum);
+    FREE(halves->sin_sum_d);
+    FREE(halves->cos_sum_d);
+    FREE(halves);
+}
+
+static struct series_halves *get_series_halves(sinoscope_t *ptr)
+{
+    struct series_halves *halves = ptr->halves;
+
+    if (halves != NULL)
+        return halves;
+    if (ALLOC(halves) < 0)
+        return NULL;
+    if (ALLOC_N(halves->sin_sum, ptr->width) < 0 || ALLOC_N(halves->cos_sum, ptr->height) < 0 ||
+            ALLOC_N(halves->sin_sum_d, ptr->width) < 0 || ALLOC_N(halves->cos_sum_d, ptr->height) < 0) {
+        free_series_halves(halves);
+        return NULL;
+    }
+    ptr->halves = halves;
+    return halves;
+}
+
+/* precision is a constant in both calls below, one specialized copy each */
+static inline int image_separable(sinoscope_t *ptr, struct series_halves *halves,
+        const int precision)
+{
+    int ret = 0;
+    int x, y;
+    float *row;
+    float *sin_sum = halves->sin_sum;
+    float *cos_sum = halves->cos_sum;
+    double *sin_sum_d = halves->sin_sum_d;
+    double *cos_sum_d = halves->cos_sum_d;
+    sinoscope_t sino = *ptr;
+
+    #pragma omp parallel private(x, y, row) reduction(|:ret)
+    {
+        #pragma omp for schedule(static) nowait
+        for (y = 1; y < sino.width - 1; y++) {
+            if (precision == PRECISION_FLOAT)
+                sin_sum[y] = taylor_sin_sum_f(pixel_px_f(y, &sino), &sino);
+            else
+                sin_sum_d[y] = taylor_sin_sum_d(pixel_px_d(y, &sino), &sino);
+        }
+
+        #pragma omp for schedule(static) nowait
+        for (x = 1; x < sino.height - 1; x++) {
+            if (precision == PRECISION_FLOAT)
+                cos_sum[x] = taylor_cos_sum_f(pixel_py_f(x, &sino), &sino);
+            else
+                cos_sum_d[x] = taylor_cos_sum_d(pixel_py_d(x, &sino), &sino);
+        }
+        #pragma omp barrier
+
+        row = malloc(sino.width * sizeof(float));
+        if (row == NULL)
+            ret = -1;
+        #pragma omp for schedule(static)
+        for (x = 1; x < sino.height - 1; x++) {
+            if (row == NULL)
+                continue;
+            for (y = 1; y < sino.width - 1; y++) {
+                if (precision == PRECISION_FLOAT)
+                    row[y] = color_value_f(sin_sum[y] + cos_sum[x]);
+                else
+                    row[y] = color_value_d(sin_sum_d[y] + cos_sum_d[x]);
+            }
+            value_color_pixels(sino.lut, &row[1], &sino.buf[(1 + x * sino.width) * sino.bpp], sino.bpp,
+                    sino.width - 2);
+        }
+        free(row);
+    }
+    return ret;
+}
+
+int sinoscope_image_separable(sinoscope_t *ptr)
+{
+    struct series_halves *halves;
+
+    if (ptr == NULL)
+        return -1;
+
+    halves = get_series_halves(ptr);
+    if (halves == NULL)
+        return -1;
+    if (ptr->precision == PRECISION_FLOAT)
+        return image_separable(ptr, halves, PRECISION_FLOAT);
+    return image_separable(ptr, halves, PRECISION_DOUBLE);
+}
@@ -0,0 +1,15 @@
+/*
+ * sinoscope_separable.h
+ *
+ * Sinoscope backend exploiting the separability of the series
+ */
+
+#ifndef SINOSCOPE_SEPARABLE_H_
+#define SINOSCOPE_SEPARABLE_H_
+
+#include "sinoscope.h"
+
+int sinoscope_image_separable(sinoscope_t *b_ptr);
+void free_series_halves(struct series_halves *halves);
+
+#endif /* SINOSCOPE_SEPARABLE_H_ */
@@ -11,41 +11,40 @@
 
 #include "color.h"
 #include "sinoscope_serial.h"
+#include "sinoscope_taylor.h"
 
-int sinoscope_image_serial(sinoscope_t *ptr)
+/* precision is a constant in both calls below, one specialized copy each */
+static inline int image_serial(sinoscope_t *ptr, const int precision)
 {
-    if (ptr == NULL)
-        return -1;
-
     sinoscope_t sino = *ptr;
-    int x, y, index, taylor;
-    struct rgb c;
-    float val, px, py;
+    int x, y;
+    float *row = malloc(sino.width * sizeof(float));
+    if (row == NULL)
+        return -1;
 
     x = 1;
     while(1) {
         y = 1;
         while(1) {
-            px = sino.dx * y - 2 * M_PI;
-            py = sino.dy * x - 2 * M_PI;
-            val = 0.0f;
-            for (taylor = 1; taylor <= sino.taylor; taylor += 2) {
-                val += sin(px * taylor * sino.phase1 + sino.time) / taylor + cos(py * taylor * sino.phase0) / taylor;
-            }
-            val = (atan(1.0 * val) - atan(-1.0 * val)) / (M_PI);
-            val = (val + 1) * 100;
-            value_color(&c, val, sino.interval, sino.interval_inv);
-            index = (y * 3) + (x * 3) * sino.width;
-            sino.buf[index + 0] = c.r;
-            sino.buf[index + 1] = c.g;
-            sino.buf[index + 2] = c.b;
+            row[y] = pixel_value(x, y, &sino, precision);
             y++;
-            if (y >= sino.height-1)
+            if (y >= sino.width-1)
                 break;
         }
+        value_color_pixels(sino.lut, &row[1], &sino.buf[(1 + x * sino.width) * sino.bpp], sino.bpp, y - 1);
         x++;
-        if (x >= sino.width-1)
+        if (x >= sino.height-1)
             break;
     }
+    free(row);
     return 0;
 }
+
+int sinoscope_image_serial(sinoscope_t *ptr)
+{
+    if (ptr == NULL)
+        return -1;
+    if (ptr->precision == PRECISION_FLOAT)
+        return image_serial(ptr, PRECISION_FLOAT);
+    return image_serial(ptr, PRECISION_DOUBLE);
+}
@@ -0,0 +1,84 @@
+/*
+ * sinoscope_taylor.h
+ *
+ * Evaluation of the sinoscope series
+ *
+ *   val = sum_{k = 1, 3, 5, ...} sin(px * k * phase1 + time) / k
+ *                              + cos(py * k * phase0) / k
+ *
+ * shared by the CPU backends, in a float and a double variant (see enum
+ * sinoscope_precision). The OpenCL kernel has its own float copy in
+ * sinoscope_kernel.cl.
+ */
+
+#ifndef SINOSCOPE_TAYLOR_H_
+#define SINOSCOPE_TAYLOR_H_
+
+#include <math.h>
+
+#include "sinoscope.h"
+
+/*
+ * Number of consecutive odd harmonics obtained by rotation before the
+ * recurrence is seeded again from libm.
+ *
+ * Accuracy budget: every rotation adds at most ~2 ulp of float error
+ * (2^-23) to the harmonic, so between two seeds a single term drifts by
+ * less than TAYLOR_RESEED * 2^-22 ~= 8e-6. The terms are weighted by 1/k,
+ * and sum(1/k) over the odd k <= 10000 is ~5.2, so the series error stays
+ * under 1e-4 for --taylor up to 10000. After the atan() mapping this is
+ * below 1e-2 on the color value, so a pixel differs from the direct
+ * evaluation by at most one color step (255 / interval) and only when it
+ * sits on a rounding boundary (~1e-4 of the pixels for --taylor 1001).
+ */
+#define TAYLOR_RESEED 32
+
+/*
+ * The rotation itself needs sin/cos of 2a and 2b, so below this number of
+ * terms the direct evaluation makes fewer libm calls.
+ */
+#define TAYLOR_RECURRENCE_MIN 7
+
+/* float variant: float variables, sinf/cosf/atanf */
+#define REAL float
+#define R(name) name##_f
+#define SIN sinf
+#define COS cosf
+#define ATAN atanf
+#define PI ((float) M_PI)
+#include "sinoscope_taylor_impl.h"
+#undef REAL
+#undef R
+#undef SIN
+#undef COS
+#undef ATAN
+#undef PI
+
+/* double variant, the reference */
+#define REAL double
+#define R(name) name##_d
+#define SIN sin
+#define COS cos
+#define ATAN atan
+#define PI M_PI
+#include "sinoscope_taylor_impl.h"
+#undef REAL
+#undef R
+#undef SIN
+#undef COS
+#undef ATAN
+#undef PI
+
+/*
+ * Color scale value of pixel (x, y). The backends call it with a constant
+ * precision from a function specialized per precision, so the test is
+ * resolved at compile time.
+ */
+static inline float pixel_value(int x, int y, const sinoscope_t *s, int precision)
+{
+    if (precision == PRECISION_FLOAT)
+        return pixel_value_f(x, y, s);
+    return pixel_value_d(x, y, s);
+}
+
+#endif /* SINOSCOPE_TAYLOR_H_ */
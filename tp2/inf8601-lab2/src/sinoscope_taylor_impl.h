@@ -0,0 +1,147 @@
+/*
+ * sinoscope_taylor_impl.h
+ *
+ * Body of the series evaluation, included once per precision by
+ * sinoscope_taylor.h with REAL, R(), SIN, COS, ATAN and PI defined. Every
+ * variable and libm call of a variant is of the same type, so the float
+ * one has no conversion to and from double left.
+ */
+
+static inline REAL R(pixel_px)(int y, const sinoscope_t *s)
+{
+    return s->dx * y - 2 * PI;
+}
+
+static inline REAL R(pixel_py)(int x, const sinoscope_t *s)
+{
+    return s->dy * x - 2 * PI;
+}
+
+/* reference evaluation, two libm calls per term */
+static inline REAL R(taylor_direct)(REAL px, REAL py, const sinoscope_t *s)
+{
+    int taylor;
+    REAL val = 0;
+
+    for (taylor = 1; taylor <= s->taylor; taylor += 2)
+        val += SIN(px * taylor * s->phase1 + s->time) / taylor + COS(py * taylor * s->phase0) / taylor;
+    return val;
+}
+
+/*
+ * Angle-addition recurrence: harmonic k + 2 is harmonic k rotated by 2a
+ * (resp. 2b), which costs 8 multiplies instead of two libm calls.
+ *
+ *   sin(x + 2a) = sin(x) cos(2a) + cos(x) sin(2a)
+ *   cos(x + 2a) = cos(x) cos(2a) - sin(x) sin(2a)
+ */
+static inline REAL R(taylor_recurrence)(REAL px, REAL py, const sinoscope_t *s)
+{
+    int k, j, last;
+    REAL val = 0;
+    REAL a = px * s->phase1;
+    REAL b = py * s->phase0;
+    REAL rac = COS(2 * a), ras = SIN(2 * a);
+    REAL rbc = COS(2 * b), rbs = SIN(2 * b);
+    REAL ss, sc, cc, cs, tmp;
+
+    for (k = 1; k <= s->taylor; k += 2 * TAYLOR_RESEED) {
+        ss = SIN(px * k * s->phase1 + s->time);
+        sc = COS(px * k * s->phase1 + s->time);
+        cc = COS(py * k * s->phase0);
+        cs = SIN(py * k * s->phase0);
+        last = k + 2 * (TAYLOR_RESEED - 1);
+        if (last > s->taylor)
+            last = s->taylor;
+        for (j = k; j <= last; j += 2) {
+            val += (ss + cc) / j;
+            tmp = ss * rac + sc * ras;
+            sc = sc * rac - ss * ras;
+            ss = tmp;
+            tmp = cc * rbc - cs * rbs;
+            cs = cs * rbc + cc * rbs;
+            cc = tmp;
+        }
+    }
+    return val;
+}
+
+/*
+ * Halves of the series, for the backends that evaluate the sin term once
+ * per column and the cos term once per row.
+ */
+static inline REAL R(taylor_sin_sum)(REAL px, const sinoscope_t *s)
+{
+    int k, j, last;
+    REAL val = 0;
+    REAL rc, rs, ss, sc, tmp;
+
+    if (s->kernel != KERNEL_RECURRENCE || s->taylor < TAYLOR_RECURRENCE_MIN) {
+        for (k = 1; k <= s->taylor; k += 2)
+            val += SIN(px * k * s->phase1 + s->time) / k;
+        return val;
+    }
+    rc = COS(2 * px * s->phase1);
+    rs = SIN(2 * px * s->phase1);
+    for (k = 1; k <= s->taylor; k += 2 * TAYLOR_RESEED) {
+        ss = SIN(px * k * s->phase1 + s->time);
+        sc = COS(px * k * s->phase1 + s->time);
+        last = k + 2 * (TAYLOR_RESEED - 1);
+        if (last > s->taylor)
+            last = s->taylor;
+        for (j = k; j <= last; j += 2) {
+            val += ss / j;
+            tmp = ss * rc + sc * rs;
+            sc = sc * rc - ss * rs;
+            ss = tmp;
+        }
+    }
+    return val;
+}
+
+static inline REAL R(taylor_cos_sum)(REAL py, const sinoscope_t *s)
+{
+    int k, j, last;
+    REAL val = 0;
+    REAL rc, rs, cc, cs, tmp;
+
+    if (s->kernel != KERNEL_RECURRENCE || s->taylor < TAYLOR_RECURRENCE_MIN) {
+        for (k = 1; k <= s->taylor; k += 2)
+            val += COS(py * k * s->phase0) / k;
+        return val;
+    }
+    rc = COS(2 * py * s->phase0);
+    rs = SIN(2 * py * s->phase0);
+    for (k = 1; k <= s->taylor; k += 2 * TAYLOR_RESEED) {
+        cc = COS(py * k * s->phase0);
+        cs = SIN(py * k * s->phase0);
+        last = k + 2 * (TAYLOR_RESEED - 1);
+        if (last > s->taylor)
+            last = s->taylor;
+        for (j = k; j <= last; j += 2) {
+            val += cc / j;
+            tmp = cc * rc - cs * rs;
+            cs = cs * rc + cc * rs;
+            cc = tmp;
+        }
+    }
+    return val;
+}
+
+static inline REAL R(taylor_value)(REAL px, REAL py, const sinoscope_t *s)
+{
+    if (s->kernel == KERNEL_RECURRENCE && s->taylor >= TAYLOR_RECURRENCE_MIN)
+        return R(taylor_recurrence)(px, py, s);
+    return R(taylor_direct)(px, py, s);
+}
+
+/* series value to the color scale, atan being odd 2 atan(v) = atan(v) - atan(-v) */
+static inline float R(color_value)(REAL val)
+{
+    return (2 * ATAN(val) / PI + 1) * 100;
+}
+
+static inline float R(pixel_value)(int x, int y, const sinoscope_t *s)
+{
+    return R(color_value)(R(taylor_value)(R(pixel_px)(y, s), R(pixel_py)(x, s), s));
+}
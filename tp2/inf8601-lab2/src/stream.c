@@ -0,0 +1,282 @@
+/*
+ * stream.c
+ *
+ * The renderer fills slot head while the writer thread empties slot tail,
+ * so computing frame k + 1 overlaps the conversion and write(2) of frame
+ * k. The renderer only blocks when all the slots are waiting to be
+ * written, that is when the output is the bottleneck.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stream.h"
+#include "sinoscope.h"
+#include "topology.h"
+#include "memory.h"
+#include "util.h"
+
+struct frame_stream {
+    int fd;
+    enum stream_format format;
+    int width;
+    int height;
+    int bpp;                    /* bytes per pixel of the slots */
+    size_t slot_size;
+    size_t frame_size;          /* bytes written per frame */
+    int nslots;
+    unsigned char **slots;
+    unsigned char *planes;      /* conversion buffer, writer only */
+    int head;                   /* next slot to render */
+    int tail;                   /* next slot to write */
+    int filled;
+    int closing;
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_free;
+    pthread_cond_t cond_filled;
+    pthread_t writer;
+    const struct topology *topo;
+    struct stream_stats stats;
+};
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("stream write failed");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* RGB24 or RGBA32 (bpp 3 or 4) to planar YCbCr 4:4:4, BT.601 studio range */
+static void rgb_to_yuv444(const unsigned char *rgb, int bpp, unsigned char *planes, int n)
+{
+    unsigned char *y = planes;
+    unsigned char *u = planes + n;
+    unsigned char *v = planes + 2 * n;
+    int i, r, g, b;
+
+    for (i = 0; i < n; i++) {
+        r = rgb[bpp * i + 0];
+        g = rgb[bpp * i + 1];
+        b = rgb[bpp * i + 2];
+        y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+static void rgba_to_rgb(const unsigned char *rgba, unsigned char *rgb, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        memcpy(&rgb[3 * i], &rgba[4 * i], 3);
+}
+
+static int write_frame(struct frame_stream *st, const unsigned char *frame)
+{
+    static const char tag[] = "FRAME\n";
+
+    if (st->format == STREAM_RAW && st->bpp == 3)
+        return write_all(st->fd, frame, st->frame_size);
+    if (st->format == STREAM_RAW) {
+        rgba_to_rgb(frame, st->planes, st->width * st->height);
+        return write_all(st->fd, st->planes, st->frame_size);
+    }
+    rgb_to_yuv444(frame, st->bpp, st->planes, st->width * st->height);
+    if (write_all(st->fd, tag, sizeof(tag) - 1) < 0)
+        return -1;
+    return write_all(st->fd, st->planes, st->frame_size);
+}
+
+static void *writer_main(void *arg)
+{
+    struct frame_stream *st = arg;
+    unsigned char *frame;
+    double t;
+    int ret;
+
+    topology_unpin(st->topo);
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (st->filled == 0 && !st->closing)
+            pthread_cond_wait(&st->cond_filled, &st->lock);
+        if (st->filled == 0)
+            break;
+        frame = st->slots[st->tail];
+        pthread_mutex_unlock(&st->lock);
+
+        t = now();
+        ret = write_frame(st, frame);
+        t = now() - t;
+
+        pthread_mutex_lock(&st->lock);
+        st->stats.write_time += t;
+        if (ret < 0) {
+            st->error = 1;
+            pthread_cond_signal(&st->cond_free);
+            break;
+        }
+        st->stats.frames++;
+        st->stats.bytes += st->frame_size;
+        st->tail = (st->tail + 1) % st->nslots;
+        st->filled--;
+        pthread_cond_signal(&st->cond_free);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+static void free_stream(struct frame_stream *st)
+{
+    int i;
+
+    if (st == NULL)
+        return;
+    if (st->slots != NULL) {
+        for (i = 0; i < st->nslots; i++)
+            FREE(st->slots[i]);
+    }
+    FREE(st->slots);
+    FREE(st->planes);
+    if (st->fd > STDOUT_FILENO)
+        close(st->fd);
+    FREE(st);
+}
+
+struct frame_stream *stream_open(const char *path, enum stream_format format,
+        int width, int height, int bpp, int slots, int fps,
+        const struct topology *topo)
+{
+    struct frame_stream *st = NULL;
+    char header[256];
+    int i, len;
+
+    st = calloc(1, sizeof(struct frame_stream));
+    ERR_NOMEM(st);
+    st->fd = -1;
+    st->format = format;
+    st->width = width;
+    st->height = height;
+    st->bpp = bpp;
+    st->slot_size = (size_t) width * height * bpp;
+    st->frame_size = (size_t) width * height * 3;
+    st->nslots = slots;
+    st->topo = topo;
+
+    /* the backends render straight into the slots, same alignment as sinoscope_t */
+    st->slots = calloc(slots, sizeof(unsigned char *));
+    ERR_NOMEM(st->slots);
+    for (i = 0; i < slots; i++) {
+        if (posix_memalign((void **) &st->slots[i], SINOSCOPE_ALIGN, st->slot_size) != 0)
+            st->slots[i] = NULL;
+        ERR_NOMEM(st->slots[i]);
+        memset(st->slots[i], 0, st->slot_size);
+    }
+    if (format == STREAM_Y4M || bpp != 3) {
+        st->planes = malloc(st->frame_size);
+        ERR_NOMEM(st->planes);
+    }
+
+    if (strcmp(path, "-") == 0) {
+        st->fd = STDOUT_FILENO;
+    } else {
+        st->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (st->fd < 0) {
+            perror(path);
+            goto error;
+        }
+    }
+
+    if (format == STREAM_Y4M) {
+        len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                width, height, fps);
+        if (write_all(st->fd, header, len) < 0)
+            goto error;
+    }
+
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->cond_free, NULL);
+    pthread_cond_init(&st->cond_filled, NULL);
+    if (pthread_create(&st->writer, NULL, writer_main, st) != 0) {
+        perror("pthread_create failed");
+        pthread_mutex_destroy(&st->lock);
+        pthread_cond_destroy(&st->cond_free);
+        pthread_cond_destroy(&st->cond_filled);
+        goto error;
+    }
+    return st;
+error:
+    free_stream(st);
+    return NULL;
+}
+
+unsigned char *stream_acquire(struct frame_stream *st)
+{
+    unsigned char *slot = NULL;
+
+    pthread_mutex_lock(&st->lock);
+    while (st->filled == st->nslots && !st->error)
+        pthread_cond_wait(&st->cond_free, &st->lock);
+    if (!st->error)
+        slot = st->slots[st->head];
+    pthread_mutex_unlock(&st->lock);
+    return slot;
+}
+
+void stream_publish(struct frame_stream *st)
+{
+    pthread_mutex_lock(&st->lock);
+    st->head = (st->head + 1) % st->nslots;
+    st->filled++;
+    pthread_cond_signal(&st->cond_filled);
+    pthread_mutex_unlock(&st->lock);
+}
+
+int stream_close(struct frame_stream *st, struct stream_stats *stats)
+{
+    int ret;
+
+    if (st == NULL)
+        return -1;
+    pthread_mutex_lock(&st->lock);
+    st->closing = 1;
+    pthread_cond_signal(&st->cond_filled);
+    pthread_mutex_unlock(&st->lock);
+    pthread_join(st->writer, NULL);
+
+    ret = st->error ? -1 : 0;
+    if (stats != NULL)
+        *stats = st->stats;
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->cond_free);
+    pthread_cond_destroy(&st->cond_filled);
+    free_stream(st);
+    return ret;
+}
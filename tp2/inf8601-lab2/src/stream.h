@@ -0,0 +1,44 @@
+/*
+ * stream.h
+ *
+ * Ring of frame buffers drained to a file descriptor by a writer thread
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+enum stream_format {
+    STREAM_RAW,
+    STREAM_Y4M,
+};
+
+struct stream_stats {
+    long frames;
+    double bytes;
+    double write_time;      /* seconds spent in the writer, conversion included */
+};
+
+struct frame_stream;
+struct topology;
+
+/*
+ * Open path ("-" for stdout) and start the writer. Frames are RGB24 or
+ * RGBA32 (bpp 3 or 4), width * height * bpp bytes, written as RGB24
+ * (STREAM_RAW) or converted to YUV 4:4:4 (STREAM_Y4M, fps is the playback
+ * rate of the header). The writer runs on every cpu of topo, not on the
+ * cpu of the pinned caller.
+ */
+struct frame_stream *stream_open(const char *path, enum stream_format format,
+        int width, int height, int bpp, int slots, int fps,
+        const struct topology *topo);
+
+/* Free slot to render the next frame into, NULL if the writer failed. */
+unsigned char *stream_acquire(struct frame_stream *st);
+
+/* Queue the slot returned by the last stream_acquire() for writing. */
+void stream_publish(struct frame_stream *st);
+
+/* Write the queued frames, stop the writer and close the output. */
+int stream_close(struct frame_stream *st, struct stream_stats *stats);
+
+#endif /* STREAM_H_ */
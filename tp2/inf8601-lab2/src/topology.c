@@ -0,0 +1,234 @@
+/*
+ * topology.c
+ *
+ * The places of a policy are an ordering of the cpus: thread id goes to
+ * place id modulo the number of places, so a given policy and thread
+ * count land on the same hardware threads from one run to the next.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "topology.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+static const char *policy_names[] = {
+    [TOPO_NONE]    = "none",
+    [TOPO_COMPACT] = "compact",
+    [TOPO_SCATTER] = "scatter",
+    [TOPO_CORE]    = "core",
+    [TOPO_SOCKET]  = "socket",
+};
+
+#define NR_POLICIES (int) (sizeof(policy_names) / sizeof(policy_names[0]))
+
+static int read_id(int cpu, const char *name)
+{
+    char path[128];
+    FILE *f;
+    int val;
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu, name);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%d", &val) != 1)
+        val = -1;
+    fclose(f);
+    return val;
+}
+
+/* qsort() has no context argument */
+static const struct topology *sort_topo;
+
+static int cmp_scatter(const void *a, const void *b)
+{
+    const struct topology_cpu *x = &sort_topo->cpus[*(const int *) a];
+    const struct topology_cpu *y = &sort_topo->cpus[*(const int *) b];
+
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    if (x->rank != y->rank)
+        return x->rank - y->rank;
+    return x->socket - y->socket;
+}
+
+static int cmp_cpu(const void *a, const void *b)
+{
+    const struct topology_cpu *x = a, *y = b;
+
+    if (x->socket != y->socket)
+        return x->socket - y->socket;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+struct topology *topology_load(void)
+{
+    struct topology *topo;
+    struct topology_cpu *c;
+    cpu_set_t allowed;
+    int cpu, i;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return NULL;
+    topo = calloc(1, sizeof(struct topology));
+    if (topo == NULL)
+        return NULL;
+    topo->cpus = calloc(CPU_COUNT(&allowed), sizeof(struct topology_cpu));
+    topo->scatter = calloc(CPU_COUNT(&allowed), sizeof(int));
+    if (topo->cpus == NULL || topo->scatter == NULL) {
+        topology_free(topo);
+        return NULL;
+    }
+    topo->allowed = allowed;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        c = &topo->cpus[topo->ncpus++];
+        c->cpu = cpu;
+        c->socket = read_id(cpu, "physical_package_id");
+        c->core = read_id(cpu, "core_id");
+        if (c->socket < 0)
+            c->socket = cpu;
+        if (c->core < 0)
+            c->core = cpu;
+    }
+    qsort(topo->cpus, topo->ncpus, sizeof(struct topology_cpu), cmp_cpu);
+
+    for (i = 0; i < topo->ncpus; i++) {
+        c = &topo->cpus[i];
+        topo->scatter[i] = i;
+        if (i > 0 && c->socket == c[-1].socket && c->core == c[-1].core) {
+            c->smt = c[-1].smt + 1;
+            c->rank = c[-1].rank;
+            continue;
+        }
+        topo->ncores++;
+        c->rank = i > 0 && c->socket == c[-1].socket ? c[-1].rank + 1 : 0;
+        if (i == 0 || c->socket != c[-1].socket)
+            topo->nsockets++;
+    }
+
+    /* the k-th sibling of the j-th core of every socket, k varies slowest */
+    sort_topo = topo;
+    qsort(topo->scatter, topo->ncpus, sizeof(int), cmp_scatter);
+    return topo;
+}
+
+void topology_free(struct topology *topo)
+{
+    if (topo == NULL)
+        return;
+    free(topo->cpus);
+    free(topo->scatter);
+    free(topo);
+}
+
+int topology_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NR_POLICIES; i++)
+        if (strcmp(policy_names[i], name) == 0)
+            return i;
+    return -1;
+}
+
+const char *topology_name(int policy)
+{
+    if (policy < 0 || policy >= NR_POLICIES)
+        return "unknown";
+    return policy_names[policy];
+}
+
+/* index in cpus[] of the n-th core (0 based), counted over all sockets */
+static int nth_core(const struct topology *topo, int n)
+{
+    int i;
+
+    for (i = 0; i < topo->ncpus; i++)
+        if (topo->cpus[i].smt == 0 && n-- == 0)
+            return i;
+    return -1;
+}
+
+/* index in cpus[] of the first cpu of socket rank n */
+static int nth_socket(const struct topology *topo, int n)
+{
+    int i;
+
+    for (i = 0; i < topo->ncpus; i++)
+        if (i == 0 || topo->cpus[i].socket != topo->cpus[i - 1].socket)
+            if (n-- == 0)
+                return i;
+    return -1;
+}
+
+int topology_cpuset(const struct topology *topo, int policy, int id, cpu_set_t *set)
+{
+    int i, first;
+
+    CPU_ZERO(set);
+    if (topo == NULL || topo->ncpus == 0 || policy <= TOPO_NONE || policy >= NR_POLICIES)
+        return 0;
+
+    switch (policy) {
+    case TOPO_COMPACT:
+        CPU_SET(topo->cpus[id % topo->ncpus].cpu, set);
+        break;
+    case TOPO_SCATTER:
+        CPU_SET(topo->cpus[topo->scatter[id % topo->ncpus]].cpu, set);
+        break;
+    case TOPO_CORE:
+        CPU_SET(topo->cpus[nth_core(topo, id % topo->ncores)].cpu, set);
+        break;
+    case TOPO_SOCKET:
+        first = nth_socket(topo, id % topo->nsockets);
+        for (i = first; i < topo->ncpus && topo->cpus[i].socket == topo->cpus[first].socket; i++)
+            CPU_SET(topo->cpus[i].cpu, set);
+        break;
+    }
+    return 1;
+}
+
+int topology_pin(const struct topology *topo, int policy, int id)
+{
+    cpu_set_t set;
+
+    if (!topology_cpuset(topo, policy, id, &set))
+        return 0;
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("sched_setaffinity failed");
+        return -1;
+    }
+    return 0;
+}
+
+int topology_unpin(const struct topology *topo)
+{
+    if (topo == NULL)
+        return 0;
+    if (sched_setaffinity(0, sizeof(topo->allowed), &topo->allowed) < 0) {
+        perror("sched_setaffinity failed");
+        return -1;
+    }
+    return 0;
+}
+
+void topology_dump(const struct topology *topo)
+{
+    int i;
+
+    printf("%d cpus, %d cores, %d sockets\n", topo->ncpus, topo->ncores, topo->nsockets);
+    for (i = 0; i < topo->ncpus; i++)
+        printf("cpu %3d socket %2d core %3d smt %d\n", topo->cpus[i].cpu,
+                topo->cpus[i].socket, topo->cpus[i].core, topo->cpus[i].smt);
+}
@@ -0,0 +1,67 @@
+/*
+ * topology.h
+ *
+ * Cpu topology from /sys/devices/system/cpu and named thread placements,
+ * shared by sinoscope and encode (and by the dragonizer of lab1, whose
+ * topology.c and topology.h are symbolic links to these)
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <sched.h>         /* cpu_set_t, needs _GNU_SOURCE */
+
+enum topology_policy {
+    TOPO_NONE,              /* leave the threads to the scheduler */
+    TOPO_COMPACT,           /* fill the SMT siblings of a core, then the next core */
+    TOPO_SCATTER,           /* round robin over the sockets, then the cores, siblings last */
+    TOPO_CORE,              /* first hardware thread of each core */
+    TOPO_SOCKET,            /* all the cpus of one socket per thread */
+};
+
+struct topology_cpu {
+    int cpu;
+    int core;               /* core_id, unique within its socket only */
+    int socket;             /* physical_package_id */
+    int rank;               /* rank of its core within the socket */
+    int smt;                /* rank among the siblings of its core */
+};
+
+struct topology {
+    int ncpus;
+    int ncores;
+    int nsockets;
+    struct topology_cpu *cpus;      /* sorted by socket, core, smt */
+    int *scatter;                   /* indices in cpus[], in scatter order */
+    cpu_set_t allowed;              /* cpus of the process when it was loaded */
+};
+
+/*
+ * Read the topology of the cpus this process may run on. The cpus sysfs
+ * does not describe are given a core and a socket of their own.
+ */
+struct topology *topology_load(void);
+void topology_free(struct topology *topo);
+
+/* TOPO_NONE for "none", -1 for an unknown name */
+int topology_lookup(const char *name);
+const char *topology_name(int policy);
+
+/*
+ * Cpus of thread id under policy, wrapping around when there are more
+ * threads than places. Returns 0 if the thread must not be pinned.
+ */
+int topology_cpuset(const struct topology *topo, int policy, int id, cpu_set_t *set);
+
+/* Pin the calling thread, 0 on success or when the policy is TOPO_NONE. */
+int topology_pin(const struct topology *topo, int policy, int id);
+
+/*
+ * Give the calling thread back every cpu of the process, for the threads
+ * started by a pinned thread. 0 on success or when topo is NULL.
+ */
+int topology_unpin(const struct topology *topo);
+
+void topology_dump(const struct topology *topo);
+
+#endif /* TOPOLOGY_H_ */
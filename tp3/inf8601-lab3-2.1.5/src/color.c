@@ -75,17 +75,83 @@ void value_color(struct rgb *color, float value, int interval,
 	*color = c;
 }
 
+/*
+ * Tabulate value_color() for every integer value of the scale. Values are
+ * truncated to an integer by the lookup, as value_color() already does for
+ * the position inside an interval.
+ */
+struct color_lut *make_color_lut(int interval, float interval_inv) {
+	int v;
+	struct color_lut *lut = calloc(1, sizeof(struct color_lut));
+	if (lut == NULL)
+		return NULL;
+	/* first value mapped to the default (white) case */
+	lut->size = 5 * interval;
+	while ((int) (lut->size * interval_inv) < 5)
+		lut->size++;
+	lut->white = lut->size;
+	lut->black = lut->size + 1;
+	lut->table = calloc(lut->size + 2, sizeof(struct rgb));
+	if (lut->table == NULL) {
+		free(lut);
+		return NULL;
+	}
+	for (v = 0; v < lut->size; v++)
+		value_color(&lut->table[v], (float) v, interval, interval_inv);
+	lut->table[lut->white] = white;
+	lut->table[lut->black] = black;
+	return lut;
+}
+
+void free_color_lut(struct color_lut *lut) {
+	if (lut == NULL)
+		return;
+	free(lut->table);
+	free(lut);
+}
+
+/*
+ * Map n values to packed RGB. The index computation has no branch and no
+ * integer modulo; NaN fails both range comparisons and ends up on the
+ * black entry, values below -1 or past the scale on the white one.
+ */
+void value_color_array(const struct color_lut *lut, const double *values,
+		unsigned char *rgb, int n) {
+	int i, idx, out;
+	double v;
+	const struct rgb *table = lut->table;
+	double size = lut->size;
+
+	for (i = 0; i < n; i++) {
+		v = values[i];
+		out = v == v ? lut->white : lut->black;
+		idx = (v > -1.0 && v < size) ? (int) v : out;
+		rgb[i * 3 + 0] = table[idx].r;
+		rgb[i * 3 + 1] = table[idx].g;
+		rgb[i * 3 + 2] = table[idx].b;
+	}
+}
+
 void hue(struct rgb **image, int width, int height) {
 	int i, j;
+	double *values;
+	struct color_lut *lut;
 
 	*image = (struct rgb*) calloc(width * height, sizeof(struct rgb));
 	struct rgb *img = *image;
 	int interval = get_color_interval((float) height);
 	float interval_inv = get_color_interval_inv((float) height);
+	values = malloc(width * sizeof(double));
+	lut = make_color_lut(interval, interval_inv);
+	if (img == NULL || values == NULL || lut == NULL)
+		goto done;
 	for (j = 0; j < height; j++) {
-		for (i = 0; i < width; i++) {
-			value_color(&img[j * width + i], (float) j, interval,
-					interval_inv);
-		}
+		for (i = 0; i < width; i++)
+			values[i] = j;
+		value_color_array(lut, values, (unsigned char *) &img[j * width],
+				width);
 	}
+done:
+	free(values);
+	free_color_lut(lut);
 }
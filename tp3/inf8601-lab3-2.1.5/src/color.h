@@ -14,6 +14,17 @@ struct rgb {
 	unsigned char b;
 };
 
+/*
+ * Precomputed color ramp: one entry per integer value of the scale, then
+ * white for the values out of the scale and black for NaN.
+ */
+struct color_lut {
+	struct rgb *table;
+	int size;
+	int white;
+	int black;
+};
+
 extern const struct rgb white;
 extern const struct rgb black;
 
@@ -23,6 +34,10 @@ void value_color(struct rgb *color, float value, int interval,
 		float interval_inv);
 void value_color_set_max(float max);
 void hue(struct rgb **image, int width, int height);
+struct color_lut *make_color_lut(int interval, float interval_inv);
+void free_color_lut(struct color_lut *lut);
+void value_color_array(const struct color_lut *lut, const double *values,
+		unsigned char *rgb, int n);
 int get_color_interval(float max);
 float get_color_interval_inv(float max);
 #endif /* COLOR_H_ */
@@ -294,7 +294,7 @@ image_t *grid_to_image(grid_t *grid) {
 		return NULL;
 
 	double max;
-	int i, j;
+	int j;
 	int w = grid->pw;
 	int h = grid->ph;
 	image_t	*img = make_image(grid->width, grid->height, 3 * w);
@@ -305,19 +305,12 @@ image_t *grid_to_image(grid_t *grid) {
 
 	int interval = get_color_interval((float) max);
 	float interval_inv = get_color_interval_inv((float) max);
+	struct color_lut *lut = make_color_lut(interval, interval_inv);
+	ERR_NOMEM(lut);
 
-	for (j = 0; j < h; j++) {
-		png_byte *row = img->rows[j];
-		for (i = 0; i < w; i++) {
-			int index = IX2(i,j,w);
-			int offset = i * 3;
-			struct rgb c;
-			value_color(&c, grid->dbl[index], interval, interval_inv);
-			row[offset + 0] = c.r;
-			row[offset + 1] = c.g;
-			row[offset + 2] = c.b;
-		}
-	}
+	for (j = 0; j < h; j++)
+		value_color_array(lut, &grid->dbl[IX2(0, j, w)], img->rows[j], w);
+	free_color_lut(lut);
 error:
 	return img;
 }
@@ -14,6 +14,7 @@
 #include "grid.h"
 #include "heat.h"
 #include "cart.h"
+#include "color.h"
 #include "unittest.h"
 
 void test_image_load()
@@ -108,8 +109,32 @@ void test_heat_cart2d()
 	free_grid(g_exp4);
 }
 
+void test_color_lut()
+{
+	int i, n = 260, mismatch = 0;
+	double values[260];
+	unsigned char rgb[260 * 3];
+	struct rgb c;
+	int interval = get_color_interval(200.0f);
+	float interval_inv = get_color_interval_inv(200.0f);
+	struct color_lut *lut = make_color_lut(interval, interval_inv);
+
+	for (i = 0; i < n; i++)
+		values[i] = i * 0.99;
+	values[0] = NAN;
+	value_color_array(lut, values, rgb, n);
+	for (i = 0; i < n; i++) {
+		value_color(&c, values[i], interval, interval_inv);
+		if (c.r != rgb[i * 3] || c.g != rgb[i * 3 + 1] || c.b != rgb[i * 3 + 2])
+			mismatch++;
+	}
+	assert_equals(0, mismatch, "test_color_lut");
+	free_color_lut(lut);
+}
+
 int main(int argc, char **argv)
 {
+	test_color_lut();
 	test_image_load();
 	test_grid_save_png();
 	test_image_heat_diffusion();